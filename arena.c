@@ -0,0 +1,46 @@
+#include "arena.h"
+
+#include <stdalign.h>
+#include <stdlib.h>
+#include <string.h>
+
+void* arena_alloc(arena* a, size_t size)
+{
+	size = (size + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+
+	struct arena_chunk* chunk = a->chunks;
+	if (chunk == NULL || chunk->size - chunk->used < size) {
+		size_t chunk_size = chunk ? 2 * chunk->size : ARENA_FIRST_CHUNK;
+		while (chunk_size < size)
+			chunk_size *= 2;
+
+		struct arena_chunk* fresh = malloc(sizeof(struct arena_chunk) + chunk_size);
+		if (fresh == NULL)
+			return NULL;
+		*fresh = (struct arena_chunk){ .next = chunk, .size = chunk_size };
+		a->chunks = chunk = fresh;
+	}
+
+	void* result = chunk->data + chunk->used;
+	chunk->used += size;
+	return result;
+}
+
+char* arena_strndup(arena* a, const char* str, size_t length)
+{
+	char* copy = arena_alloc(a, length + 1);
+	if (copy == NULL)
+		return NULL;
+	memcpy(copy, str, length);
+	copy[length] = 0;
+	return copy;
+}
+
+void arena_free(arena* a)
+{
+	while (a->chunks) {
+		struct arena_chunk* next = a->chunks->next;
+		free(a->chunks);
+		a->chunks = next;
+	}
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stddef.h>
+
+#define ARENA_FIRST_CHUNK (64 * 1024)
+
+struct arena_chunk
+{
+	struct arena_chunk* next;
+	size_t size, used;
+	_Alignas(max_align_t) char data[];
+};
+
+// bump allocator for things that all die together, like the texts of one
+// compilation; every chunk doubles the last, so freeing takes a few free calls
+// however much was allocated
+typedef struct
+{
+	struct arena_chunk* chunks; // newest first
+} arena;
+
+#define ARENA_EMPTY (arena) { .chunks = NULL }
+
+// aligned for any type, NULL when out of memory
+void* arena_alloc(arena* a, size_t size);
+// copies length bytes of str and terminates them
+char* arena_strndup(arena* a, const char* str, size_t length);
+void arena_free(arena* a);
@@ -76,15 +76,20 @@ const char* token_str[] = {
 	"TOKEN_NONE"
 };
 
-token *t, *st;
+// state of a single build_ast call: t is where the current rule started, st is the next token
+typedef struct {
+	token *t, *st;
+	AST* ast;
+	size_t capacity; // of ast->nodes
+} parser;
 
 typedef enum { RULE_PASS, RULE_ACCEPT, RULE_ERROR } rule_result_t;
 
-#define ACCEPT do { t = st; return RULE_ACCEPT; } while (0)
+#define ACCEPT do { p->t = p->st; return RULE_ACCEPT; } while (0)
 #define PASS do { return RULE_PASS; } while(0)
-#define NEXT_TOKEN *st++
-#define ROLLBACK_ONCE do { --st; } while (0)
-#define ROLLBACK_TOKEN do { st = t; PASS; } while (0)
+#define NEXT_TOKEN *p->st++
+#define ROLLBACK_ONCE do { --p->st; } while (0)
+#define ROLLBACK_TOKEN do { p->st = p->t; PASS; } while (0)
 #define EXPECTED(new_token, predicate) token new_token = NEXT_TOKEN;\
 if (! (predicate) ) {\
 	fprintf(stderr, "predicate " #predicate " failed for %s\n", token_str[new_token.type]);\
@@ -92,28 +97,42 @@ if (! (predicate) ) {\
 }
 #define EXPECTED_IF(new_token, first_predicate, token_predicate) token new_token = NEXT_TOKEN;\
 if ( ! (first_predicate) ) {\
-	--st;\
+	--p->st;\
 	new_token.type = TOKEN_NONE;\
 } else if (! (token_predicate) ) {\
 	return 2;\
 }
 #define MAYBE_TOKEN(new_token, predicate) token new_token = NEXT_TOKEN; if (! (predicate) ) { ROLLBACK_TOKEN; }
-#define OPTIONAL(new_token, predicate) token new_token = NEXT_TOKEN; if (! (predicate)) { --st; new_token.type = TOKEN_NONE; }
+#define OPTIONAL(new_token, predicate) token new_token = NEXT_TOKEN; if (! (predicate)) { --p->st; new_token.type = TOKEN_NONE; }
 #define OPTIONAL_IF(new_token, first_predicate, token_predicate) token new_token = NEXT_TOKEN; if (token_predicate) {\
 		if (!(first_predicate)) { fprintf(stderr, "optional token encountered while 1st predicate failed\n"); return RULE_ERROR; }\
-	} else { --st; new_token.type = TOKEN_NONE; }
+	} else { --p->st; new_token.type = TOKEN_NONE; }
 
-static int add_ast_node(AST* ast, AST_node node)
+static int add_ast_node(parser* p, AST_node node)
 {
-	ast->nodes = realloc(ast->nodes, sizeof(AST_node) * ++ast->size);
-	if (ast->nodes == NULL)
-		return 0;
-	ast->nodes[ast->size - 1] = node;
+	AST* ast = p->ast;
+	node.line = p->t->line;
+	node.col = p->t->col;
+	if (ast->size == p->capacity) {
+		size_t capacity = p->capacity ? 2 * p->capacity : 256;
+		AST_node* nodes = realloc(ast->nodes, sizeof(AST_node) * capacity);
+		if (nodes == NULL)
+			return 0;
+		ast->nodes = nodes;
+		p->capacity = capacity;
+	}
+	ast->nodes[ast->size++] = node;
 	return 1;
 }
 
+// string tokens are slices of the source, the AST gets its own copies
+static const char* token_text(parser* p, const token* t)
+{
+	return arena_strndup(&p->ast->strings, t->as_text, t->length);
+}
+
 
-static int register_from_token(kyou_register_t* dest)
+static int register_from_token(parser* p, kyou_register_t* dest)
 {
 	token reg_tok = NEXT_TOKEN;
 
@@ -129,7 +148,7 @@ static int register_from_token(kyou_register_t* dest)
 	}
 }
 
-static int immediate_from_token(int64_t* dest)
+static int immediate_from_token(parser* p, int64_t* dest)
 {
 	token num_tok = NEXT_TOKEN;
 
@@ -143,7 +162,7 @@ static int immediate_from_token(int64_t* dest)
 	}
 }
 
-static int label_from_token(const char** name)
+static int label_from_token(parser* p, uint32_t* symbol)
 {
 	token label_tok = NEXT_TOKEN;
 	if (label_tok.type != TOKEN_LABEL) {
@@ -157,21 +176,21 @@ static int label_from_token(const char** name)
 		return 0;
 	}
 
-	*name = id_tok.as_cstr;
+	*symbol = id_tok.as_symbol;
 	return 1;
 }
 
-static int address_from_token(AST_address* dest)
+static int address_from_token(parser* p, AST_address* dest)
 {
-	if (register_from_token(&dest->as_reg)) {
+	if (register_from_token(p, &dest->as_reg)) {
 		dest->type = ADDRESS_REGISTER;
 		return 1;
 	}
-	else if (label_from_token(&dest->as_label)) {
+	else if (label_from_token(p, &dest->as_label)) {
 		dest->type = ADDRESS_LABEL;
 		return 1;
 	}
-	else if (immediate_from_token((size_t*)&dest->as_immediate)) {
+	else if (immediate_from_token(p, (size_t*)&dest->as_immediate)) {
 		dest->type = ADDRESS_IMMEDIATE;
 		return 1;
 	}
@@ -179,7 +198,7 @@ static int address_from_token(AST_address* dest)
 	return 0;
 }
 
-static int mem_from_token(AST_address* dest)
+static int mem_from_token(parser* p, AST_address* dest)
 {
 	token star_tok = NEXT_TOKEN;
 	if (star_tok.type != TOKEN_STARS) {
@@ -187,10 +206,10 @@ static int mem_from_token(AST_address* dest)
 		return 0;
 	}
 
-	return address_from_token(dest);
+	return address_from_token(p, dest);
 }
 
-static int fd_from_token(int* fd)
+static int fd_from_token(parser* p, int* fd)
 {
 	token fd_tok = NEXT_TOKEN;
 
@@ -217,18 +236,18 @@ static int power_from_token(kyou_power_t* power, token_type type)
 	}
 }
 
-static int source_from_token(AST_source* src)
+static int source_from_token(parser* p, AST_source* src)
 {
-	if (register_from_token(&src->as_reg)) {
+	if (register_from_token(p, &src->as_reg)) {
 		src->type = SOURCE_REGISTER;
 	}
-	else if (immediate_from_token(&src->as_immediate)) {
+	else if (immediate_from_token(p, &src->as_immediate)) {
 		src->type = SOURCE_IMMEDIATE;
 	}
-	else if (mem_from_token(&src->as_mem)) {
+	else if (mem_from_token(p, &src->as_mem)) {
 		src->type = SOURCE_MEM;
 	}
-	else if (label_from_token(&src->as_label)) {
+	else if (label_from_token(p, &src->as_label)) {
 		src->type = SOURCE_LABEL;
 	}
 	else {
@@ -246,15 +265,15 @@ static int source_from_token(AST_source* src)
 	return 1;
 }
 
-static int destination_from_token(AST_destination* dest)
+static int destination_from_token(parser* p, AST_destination* dest)
 {
-	if (register_from_token(&dest->as_reg)) {
+	if (register_from_token(p, &dest->as_reg)) {
 		dest->type = DESTINATION_REGISTER;
 	}
-	else if (fd_from_token(&dest->as_fd)) {
+	else if (fd_from_token(p, &dest->as_fd)) {
 		dest->type = DESTINATION_FD;
 	}
-	else if (mem_from_token(&dest->as_mem)) {
+	else if (mem_from_token(p, &dest->as_mem)) {
 		dest->type = DESTINATION_MEM;
 	}
 	else return 0;
@@ -275,11 +294,11 @@ static int destination_from_token(AST_destination* dest)
 	return 1;
 }
 
-int arithm_op_rule(AST* ast)
+int arithm_op_rule(parser* p)
 {
 	AST_node node;
 
-	if (!register_from_token(&node.op_reg)) {
+	if (!register_from_token(p, &node.op_reg)) {
 		return RULE_PASS;
 	}
 
@@ -306,46 +325,46 @@ int arithm_op_rule(AST* ast)
 		}
 	}
 
-	if (!source_from_token(&node.op_src)) {
-		fprintf(stderr, "failed at unknown source %s\n", token_str[st->type]);
+	if (!source_from_token(p, &node.op_src)) {
+		fprintf(stderr, "failed at unknown source %s\n", token_str[p->st->type]);
 		return RULE_ERROR;
 	}
-	add_ast_node(ast, node);
+	add_ast_node(p, node);
 	ACCEPT;
 }
 
-int move_rule(AST* ast)
+int move_rule(parser* p)
 {
 	AST_node node;
 
-	if (!source_from_token(&node.move_src))
+	if (!source_from_token(p, &node.move_src))
 		return RULE_PASS;
 
 	MAYBE_TOKEN(move_tok, move_tok.type == TOKEN_MOVE)
 	node.type = MOVE_STATEMENT;
 
-	if (!destination_from_token(&node.move_dest))
+	if (!destination_from_token(p, &node.move_dest))
 		return RULE_ERROR;
 
-	add_ast_node(ast, node);
+	add_ast_node(p, node);
 	ACCEPT;
 }
 
-int label_rule(AST* ast)
+int label_rule(parser* p)
 {
 	MAYBE_TOKEN(label_tok, label_tok.type == TOKEN_LABEL)
 	EXPECTED(id_tok, id_tok.type == TOKEN_IDENTIFIER)
 
-	add_ast_node(ast, (AST_node){ .type = LABEL, .id = id_tok.as_cstr });
+	add_ast_node(p, (AST_node){ .type = LABEL, .symbol = id_tok.as_symbol });
 	ACCEPT;
 }
 
-int branch_rule(AST* ast)
+int branch_rule(parser* p)
 {
 	AST_node node;
 
 	MAYBE_TOKEN(branch_tok, branch_tok.type == TOKEN_BRANCH)
-	if (!address_from_token(&node.branch_addr))
+	if (!address_from_token(p, &node.branch_addr))
 		return RULE_ERROR;
 
 	node.type = BRANCH_STATEMENT;
@@ -358,70 +377,70 @@ int branch_rule(AST* ast)
 		// conditional jump
 		ROLLBACK_ONCE;
 		
-		if (!source_from_token(&node.branch_a))
+		if (!source_from_token(p, &node.branch_a))
 			return RULE_ERROR;
 
 		EXPECTED(type_tok, IS_BRANCH_TYPE(type_tok.type))
 		node.branch_type = (type_tok.type == TOKEN_EQUALS ? BRANCH_EQUALS : (type_tok.type == TOKEN_GREATER ? BRANCH_GREATER : BRANCH_LESS ));
 
-		if (!source_from_token(&node.branch_b))
+		if (!source_from_token(p, &node.branch_b))
 			return RULE_ERROR;
 	}
 
-	add_ast_node(ast, node);
+	add_ast_node(p, node);
 	ACCEPT;
 }
 
-int push_rule(AST* ast)
+int push_rule(parser* p)
 {
 	AST_node node;
 	
 	MAYBE_TOKEN(push_tok, push_tok.type == TOKEN_PUSH)
-	if (!source_from_token(&node.push_from))
+	if (!source_from_token(p, &node.push_from))
 		return RULE_ERROR;
 
 	node.type = PUSH_STATEMENT;
 	
-	add_ast_node(ast, node);
+	add_ast_node(p, node);
 	ACCEPT;
 }
 
-int pop_rule(AST* ast)
+int pop_rule(parser* p)
 {
 	AST_node node;
 
 	MAYBE_TOKEN(pop_tok, pop_tok.type == TOKEN_POP)
-	if (!destination_from_token(&node.pop_to))
+	if (!destination_from_token(p, &node.pop_to))
 		return RULE_ERROR;
 
 	node.type = POP_STATEMENT;
 	
-	add_ast_node(ast, node);
+	add_ast_node(p, node);
 	ACCEPT;
 }
 
-int call_rule(AST* ast)
+int call_rule(parser* p)
 {
 	AST_node node;
 
 	MAYBE_TOKEN(call_tok, call_tok.type == TOKEN_CALL)
-	if (!address_from_token(&node.call_to))
+	if (!address_from_token(p, &node.call_to))
 		return RULE_ERROR;
 
 	node.type = CALL_STATEMENT;
 	
-	add_ast_node(ast, node);
+	add_ast_node(p, node);
 	ACCEPT;
 }
 
-int return_rule(AST* ast)
+int return_rule(parser* p)
 {
 	MAYBE_TOKEN(return_tok, return_tok.type == TOKEN_RETURN)
-	add_ast_node(ast, (AST_node) { .type = RETURN_STATEMENT });
+	add_ast_node(p, (AST_node) { .type = RETURN_STATEMENT });
 	ACCEPT;
 }
 
-int temp_str_print(AST* ast)
+int temp_str_print(parser* p)
 {
 	AST_node node;
 
@@ -430,8 +449,8 @@ int temp_str_print(AST* ast)
 	EXPECTED(sun_tok, sun_tok.type == TOKEN_SUN)
 	
 	node.type = TEMP_STR_PRINT;
-	node.id = str_tok.as_cstr;
-	add_ast_node(ast, node);
+	node.id = token_text(p, &str_tok);
+	add_ast_node(p, node);
 	ACCEPT;
 }
 
@@ -446,28 +465,27 @@ int temp_str_print(AST* ast)
 #undef ROLLBACK_ONCE
 #undef NEXT_TOKEN
 
-ast_result_t build_ast(AST* ast, unsigned char* data, size_t data_size)
+ast_result_t build_ast(AST* ast, const unsigned char* data, size_t data_size)
 {
-	ast->nodes = NULL;
-	ast->size = 0;
+	*ast = (AST){ .symbols = SYMBOL_TABLE_EMPTY, .strings = ARENA_EMPTY };
 
 	tokens toks;
-	if (tokenize(&toks, (const char*)data, data_size) == TOKENIZE_ERROR) {
+	if (tokenize(&toks, &ast->symbols, (const char*)data, data_size) == TOKENIZE_ERROR) {
 		fprintf(stderr, "failed to tokenize, aborting AST building\n");
+		tokens_free(&toks);
+		ast_free(ast);
 		return AST_ERROR;
 	}
 
-	for (size_t i = 0; i < toks.size; ++i) {
-		fprintf(stderr, "%s\n", token_str[toks.data[i].type]);
-	}
+	parser p = { .ast = ast };
 
-	for (t = toks.data; t < toks.data + toks.size;)
+	for (p.t = toks.data; p.t < toks.data + toks.size;)
 	{	
-		st = t;
-		if (st->type == TOKEN_EOF)
+		p.st = p.t;
+		if (p.st->type == TOKEN_EOF)
 			break;
 		int rule_result;
-#define CHECK_RULE(func) rule_result = func(ast); if (rule_result == RULE_ACCEPT) continue; if (rule_result == RULE_ERROR) goto error;
+#define CHECK_RULE(func) rule_result = func(&p); if (rule_result == RULE_ACCEPT) continue; if (rule_result == RULE_ERROR) goto error;
 		CHECK_RULE(arithm_op_rule)
 		CHECK_RULE(move_rule)
 		CHECK_RULE(label_rule)
@@ -479,9 +497,132 @@ ast_result_t build_ast(AST* ast, unsigned char* data, size_t data_size)
 		CHECK_RULE(temp_str_print)
 #undef CHECK_RULE
 error:
-		fprintf(stderr, "syntax error at line %u, %u\n", t->line, t->col);
+		fprintf(stderr, "syntax error at line %u, %u\n", p.t->line, p.t->col);
+		tokens_free(&toks);
+		ast_free(ast);
 		return AST_ERROR;
 	}
+	// the nodes hold everything they need from the tokens by now
+	tokens_free(&toks);
 	return AST_SUCCESS;
 
 }
+
+void ast_free(AST* ast)
+{
+	free(ast->nodes);
+	ast->nodes = NULL;
+	ast->size = 0;
+	symbols_free(&ast->symbols);
+	arena_free(&ast->strings);
+}
+
+const char* ast_names[] = {
+	"MOVE_STATEMENT",
+	"OPERATOR_STATEMENT",
+	"LABEL",
+	"BRANCH_STATEMENT",
+	"PUSH_STATEMENT",
+	"POP_STATEMENT",
+	"CALL_STATEMENT",
+	"RETURN_STATEMENT",
+	"STORE",
+	"TEMP_STR_PRINT"
+};
+
+static const char* register_names[] = { KANJI_FIRE, KANJI_WATER, KANJI_TREE, KANJI_METAL, KANJI_EARTH, KANJI_STORAGE, KANJI_STORAGE_BASE };
+static const char* power_names[] = { KANJI_SPRING, KANJI_SUMMER, KANJI_AUTUMN, KANJI_WINTER, KANJI_STRING, KANJI_CHAR };
+static const char* op_names[] = { "ADD", "SUB", "MUL", "DIV", "MOD", "OR", "AND", "XOR" };
+static const char* branch_names[] = { "ALWAYS", "GREATER", "LESS", "EQUALS", "GREATER_OR_EQ", "LESS_OR_EQ" };
+
+const char* ast_label_name(const AST* ast, size_t index)
+{
+	return symbol_name(&ast->symbols, ast->nodes[index].symbol);
+}
+
+static void dump_address(const AST* ast, const AST_address* addr, FILE* file)
+{
+	switch (addr->type) {
+		case ADDRESS_LABEL: fprintf(file, "%s", symbol_name(&ast->symbols, addr->as_label)); break;
+		case ADDRESS_IMMEDIATE: fprintf(file, "%zu", addr->as_immediate); break;
+		case ADDRESS_REGISTER: fprintf(file, "%s", register_names[addr->as_reg]); break;
+		case ADDRESS_NODE: fprintf(file, "@%zu(%s)", addr->as_node, ast_label_name(ast, addr->as_node)); break;
+	}
+}
+
+static void dump_source(const AST* ast, const AST_source* src, FILE* file)
+{
+	switch (src->type) {
+		case SOURCE_REGISTER: fprintf(file, "%s", register_names[src->as_reg]); break;
+		case SOURCE_IMMEDIATE: fprintf(file, "%lld", (long long)src->as_immediate); break;
+		case SOURCE_MEM: fprintf(file, "[");  dump_address(ast, &src->as_mem, file); fprintf(file, "]"); break;
+		case SOURCE_FD: fprintf(file, "fd %d", src->as_fd); break;
+		case SOURCE_LABEL: fprintf(file, "&%s", symbol_name(&ast->symbols, src->as_label)); break;
+		case SOURCE_NODE: fprintf(file, "&@%zu(%s)", src->as_node, ast_label_name(ast, src->as_node)); break;
+	}
+	if (src->power != POWER_WINTER)
+		fprintf(file, "%s", power_names[src->power]);
+}
+
+static void dump_destination(const AST* ast, const AST_destination* dest, FILE* file)
+{
+	switch (dest->type) {
+		case DESTINATION_REGISTER: fprintf(file, "%s", register_names[dest->as_reg]); break;
+		case DESTINATION_MEM: fprintf(file, "["); dump_address(ast, &dest->as_mem, file); fprintf(file, "]"); break;
+		case DESTINATION_FD: fprintf(file, "fd %d", dest->as_fd); break;
+	}
+	if (dest->power != POWER_WINTER)
+		fprintf(file, "%s", power_names[dest->power]);
+}
+
+void ast_dump(const AST* ast, FILE* file)
+{
+	for (size_t i = 0; i < ast->size; ++i) {
+		const AST_node* node = &ast->nodes[i];
+
+		fprintf(file, "%zu\t%s", i, ast_names[node->type]);
+		switch (node->type) {
+			case MOVE_STATEMENT:
+				fprintf(file, " ");
+				dump_source(ast, &node->move_src, file);
+				fprintf(file, " -> ");
+				dump_destination(ast, &node->move_dest, file);
+				break;
+			case OPERATOR_STATEMENT:
+				fprintf(file, " %s%s %s ", register_names[node->op_reg], node->op_power != POWER_WINTER ? power_names[node->op_power] : "", op_names[node->op_type]);
+				dump_source(ast, &node->op_src, file);
+				break;
+			case LABEL:
+				fprintf(file, " %s", symbol_name(&ast->symbols, node->symbol));
+				break;
+			case BRANCH_STATEMENT:
+				fprintf(file, " %s ", branch_names[node->branch_type]);
+				dump_address(ast, &node->branch_addr, file);
+				if (node->branch_type != BRANCH_ALWAYS) {
+					fprintf(file, " if ");
+					dump_source(ast, &node->branch_a, file);
+					fprintf(file, ", ");
+					dump_source(ast, &node->branch_b, file);
+				}
+				break;
+			case PUSH_STATEMENT:
+				fprintf(file, " ");
+				dump_source(ast, &node->push_from, file);
+				break;
+			case POP_STATEMENT:
+				fprintf(file, " ");
+				dump_destination(ast, &node->pop_to, file);
+				break;
+			case CALL_STATEMENT:
+				fprintf(file, " ");
+				dump_address(ast, &node->call_to, file);
+				break;
+			case TEMP_STR_PRINT:
+				fprintf(file, " \"%s\"", node->id);
+				break;
+			default:
+				break;
+		}
+		fprintf(file, "\n");
+	}
+}
@@ -2,6 +2,10 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
+
+#include "arena.h"
+#include "tokens.h"
 
 typedef enum { POWER_SPRING, POWER_SUMMER, POWER_AUTUMN, POWER_WINTER, POWER_STRING, POWER_CHAR } kyou_power_t;
 typedef enum { REG_FIRE, REG_WATER, REG_TREE, REG_METAL, REG_EARTH, REG_STORAGE, REG_STORAGE_BASE } kyou_register_t;
@@ -31,23 +35,25 @@ typedef struct {
 } AST_value;
 
 typedef struct {
-	enum { ADDRESS_LABEL, ADDRESS_IMMEDIATE, ADDRESS_REGISTER } type;
+	enum { ADDRESS_LABEL, ADDRESS_IMMEDIATE, ADDRESS_REGISTER, ADDRESS_NODE } type;
 	union {
-		const char* as_label;
+		uint32_t as_label; // symbol of the label
+		size_t as_node; // index of the LABEL node, filled in by link_ast
 		size_t as_immediate;
 		kyou_register_t as_reg;
 	};
 } AST_address;
 
 typedef struct {
-	enum { SOURCE_REGISTER, SOURCE_IMMEDIATE, SOURCE_MEM, SOURCE_FD, SOURCE_LABEL } type;
+	enum { SOURCE_REGISTER, SOURCE_IMMEDIATE, SOURCE_MEM, SOURCE_FD, SOURCE_LABEL, SOURCE_NODE } type;
 	kyou_power_t power;
 	union {
 		kyou_register_t as_reg;
 		int64_t as_immediate;
 		AST_address as_mem;
 		int as_fd;
-		const char* as_label;
+		uint32_t as_label; // symbol of the label
+		size_t as_node;
 	};
 } AST_source;
 
@@ -78,7 +84,8 @@ typedef struct
 		};
 		struct {
 			union {
-				const char* id;
+				const char* id; // text of TEMP_STR_PRINT
+				uint32_t symbol; // of a LABEL
 				size_t as_size_t;
 			};
 		};
@@ -101,14 +108,23 @@ typedef struct
 			AST_value value;
 		};
 	};
+	uint32_t line, col; // of the first token of the statement
 } AST_node;
 
 typedef struct
 {
 	AST_node* nodes;
 	size_t size;
+	symbol_table symbols; // label names
+	arena strings; // the string literals the nodes point to
 } AST;
 
 typedef enum { AST_SUCCESS, AST_ERROR } ast_result_t;
 
-ast_result_t build_ast(AST* ast, unsigned char* data, size_t data_size);
+// the AST keeps nothing of data, which can go right after
+ast_result_t build_ast(AST* ast, const unsigned char* data, size_t data_size);
+void ast_free(AST* ast);
+// name of the label node at index
+const char* ast_label_name(const AST* ast, size_t index);
+// one node per line, linked addresses as @index(label)
+void ast_dump(const AST* ast, FILE* file);
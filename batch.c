@@ -0,0 +1,330 @@
+#include "batch.h"
+
+#include "cache.h"
+#include "sched.h"
+
+#include <dirent.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+typedef struct {
+	char* path;
+	int status;
+	double milliseconds;
+	char* output;
+	size_t output_size;
+	size_t output_capacity;
+} batch_job;
+
+// jobs [begin, end) are queued on a worker: the owner takes them from the
+// front, idle workers steal the back half
+typedef struct {
+	pthread_mutex_t lock;
+	size_t begin, end;
+} job_queue;
+
+struct batch;
+
+typedef struct {
+	struct batch* batch;
+	size_t id;
+	job_queue queue;
+	pthread_t thread;
+} batch_worker;
+
+typedef struct batch {
+	batch_job* jobs;
+	size_t jobs_size;
+	batch_worker* workers;
+	size_t workers_size;
+	const batch_options* batch_options;
+	const interpret_options* options;
+} batch;
+
+static void add_job(batch* b, char* path)
+{
+	b->jobs = realloc(b->jobs, sizeof(batch_job) * (b->jobs_size + 1));
+	b->jobs[b->jobs_size++] = (batch_job){ .path = path, .status = EXIT_FAILURE };
+}
+
+static int compare_names(const void* a, const void* b)
+{
+	return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// adds the .kyo files of a directory, sorted so the order does not depend on the file system
+static int add_directory(batch* b, const char* path)
+{
+	DIR* dir = opendir(path);
+	if (!dir) {
+		fprintf(stderr, "error: could not open directory %s\n", path);
+		return 0;
+	}
+
+	char** names = NULL;
+	size_t names_size = 0;
+	struct dirent* entry;
+	while ((entry = readdir(dir))) {
+		size_t length = strlen(entry->d_name);
+		if (length <= 4 || strcmp(entry->d_name + length - 4, ".kyo") != 0)
+			continue;
+
+		char* name = malloc(strlen(path) + length + 2);
+		sprintf(name, "%s/%s", path, entry->d_name);
+		names = realloc(names, sizeof(char*) * (names_size + 1));
+		names[names_size++] = name;
+	}
+	closedir(dir);
+
+	qsort(names, names_size, sizeof(char*), compare_names);
+	for (size_t i = 0; i < names_size; ++i)
+		add_job(b, names[i]);
+	free(names);
+	return 1;
+}
+
+static void job_sink(void* context, const char* data, size_t size)
+{
+	batch_job* job = context;
+
+	if (job->output_size + size > job->output_capacity) {
+		while (job->output_size + size > job->output_capacity)
+			job->output_capacity = job->output_capacity ? 2 * job->output_capacity : 4096;
+		job->output = realloc(job->output, job->output_capacity);
+	}
+	memcpy(job->output + job->output_size, data, size);
+	job->output_size += size;
+}
+
+static double now_milliseconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// loads the program of job and points vm at it, output goes into the job
+static int start_job(kyou_vm* vm, batch_job* job, kyou_program* program, const batch* b)
+{
+	if (!load_program_file(job->path, b->options, b->batch_options->use_cache, program))
+		return 0;
+
+	vm->program = program;
+	vm_reset(vm);
+	output_init(&vm->output, job_sink, job, 0);
+	return 1;
+}
+
+// a failed run leaves registers and stack as they were, start_job resets them
+static void finish_job(kyou_vm* vm, batch_job* job, kyou_program* program, vm_status_t status, double start)
+{
+	job->status = status == VM_HALTED ? EXIT_SUCCESS : EXIT_FAILURE;
+	job->milliseconds = now_milliseconds() - start;
+	vm->program = NULL;
+	program_free(program);
+}
+
+static int take_job(batch_worker* worker, size_t* index)
+{
+	job_queue* queue = &worker->queue;
+	int found = 0;
+
+	pthread_mutex_lock(&queue->lock);
+	if (queue->begin < queue->end) {
+		*index = queue->begin++;
+		found = 1;
+	}
+	pthread_mutex_unlock(&queue->lock);
+	return found;
+}
+
+static int steal_jobs(batch_worker* worker)
+{
+	batch* b = worker->batch;
+
+	for (size_t i = 1; i < b->workers_size; ++i) {
+		job_queue* victim = &b->workers[(worker->id + i) % b->workers_size].queue;
+		size_t begin, end;
+
+		pthread_mutex_lock(&victim->lock);
+		end = victim->end;
+		begin = end - (end - victim->begin + 1) / 2;
+		victim->end = begin;
+		pthread_mutex_unlock(&victim->lock);
+
+		if (begin < end) {
+			pthread_mutex_lock(&worker->queue.lock);
+			worker->queue.begin = begin;
+			worker->queue.end = end;
+			pthread_mutex_unlock(&worker->queue.lock);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int next_job(batch_worker* worker, size_t* index)
+{
+	return take_job(worker, index) || (steal_jobs(worker) && take_job(worker, index));
+}
+
+// one program after the other, each running to its end
+static void run_jobs(batch_worker* worker, kyou_vm* vm)
+{
+	batch* b = worker->batch;
+	size_t index;
+
+	while (next_job(worker, &index)) {
+		batch_job* job = &b->jobs[index];
+		kyou_program program;
+		double start = now_milliseconds();
+
+		if (!start_job(vm, job, &program, b)) {
+			job->milliseconds = now_milliseconds() - start;
+			continue;
+		}
+		finish_job(vm, job, &program, vm_run(vm, b->options), start);
+	}
+}
+
+// up to interleave programs at once, taking turns of slice fuel each
+static void run_jobs_interleaved(batch_worker* worker, kyou_vm* vms, size_t interleave)
+{
+	batch* b = worker->batch;
+	scheduler s;
+	batch_job** jobs = calloc(interleave, sizeof(batch_job*));
+	kyou_program* programs = calloc(interleave, sizeof(kyou_program));
+	double* starts = calloc(interleave, sizeof(double));
+
+	scheduler_init(&s, b->batch_options->slice);
+
+	// a free VM slot picks up jobs until one of them loads
+	size_t index;
+	int more = 1;
+	for (size_t slot = 0; slot < interleave && more; ++slot) {
+		while ((more = next_job(worker, &index))) {
+			jobs[slot] = &b->jobs[index];
+			starts[slot] = now_milliseconds();
+			if (start_job(&vms[slot], jobs[slot], &programs[slot], b)) {
+				scheduler_add(&s, &vms[slot]);
+				break;
+			}
+			jobs[slot]->milliseconds = now_milliseconds() - starts[slot];
+		}
+	}
+
+	while (s.size) {
+		vm_status_t status;
+		kyou_vm* vm = scheduler_run(&s, &status);
+		if (!vm)
+			continue;
+
+		size_t slot = vm - vms;
+		finish_job(vm, jobs[slot], &programs[slot], status, starts[slot]);
+		while (more && (more = next_job(worker, &index))) {
+			jobs[slot] = &b->jobs[index];
+			starts[slot] = now_milliseconds();
+			if (start_job(vm, jobs[slot], &programs[slot], b)) {
+				scheduler_add(&s, vm);
+				break;
+			}
+			jobs[slot]->milliseconds = now_milliseconds() - starts[slot];
+		}
+	}
+
+	scheduler_free(&s);
+	free(jobs);
+	free(programs);
+	free(starts);
+}
+
+static void* worker_main(void* arg)
+{
+	batch_worker* worker = arg;
+	batch* b = worker->batch;
+	size_t interleave = b->batch_options->interleave > 1 ? b->batch_options->interleave : 1;
+
+	kyou_vm* vms = malloc(sizeof(kyou_vm) * interleave);
+	size_t ready = 0;
+	while (vms && ready < interleave && vm_init(&vms[ready], NULL, job_sink, NULL, b->options))
+		++ready;
+
+	if (ready == interleave) {
+		if (interleave > 1)
+			run_jobs_interleaved(worker, vms, interleave);
+		else
+			run_jobs(worker, vms);
+	}
+
+	for (size_t i = 0; i < ready; ++i)
+		vm_destroy(&vms[i]);
+	free(vms);
+	return NULL;
+}
+
+int run_batch(char* const* paths, size_t count, const batch_options* batch_options, const interpret_options* options)
+{
+	batch b = { .batch_options = batch_options, .options = options };
+	unsigned threads = batch_options->threads;
+
+	for (size_t i = 0; i < count; ++i) {
+		struct stat st;
+		if (stat(paths[i], &st) == 0 && S_ISDIR(st.st_mode)) {
+			add_directory(&b, paths[i]);
+		} else {
+			char* path = malloc(strlen(paths[i]) + 1);
+			strcpy(path, paths[i]);
+			add_job(&b, path);
+		}
+	}
+
+	if (threads == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cpus > 0 ? cpus : 1;
+	}
+	b.workers_size = threads < b.jobs_size ? threads : b.jobs_size;
+	b.workers = calloc(b.workers_size, sizeof(batch_worker));
+
+	// deal the jobs out in contiguous runs, stealing evens out the rest
+	for (size_t i = 0; i < b.workers_size; ++i) {
+		batch_worker* worker = &b.workers[i];
+		worker->batch = &b;
+		worker->id = i;
+		pthread_mutex_init(&worker->queue.lock, NULL);
+		worker->queue.begin = b.jobs_size * i / b.workers_size;
+		worker->queue.end = b.jobs_size * (i + 1) / b.workers_size;
+	}
+	for (size_t i = 0; i < b.workers_size; ++i) {
+		if (pthread_create(&b.workers[i].thread, NULL, worker_main, &b.workers[i]) != 0) {
+			fprintf(stderr, "error: could not start worker thread\n");
+			b.workers[i].thread = 0;
+		}
+	}
+	for (size_t i = 0; i < b.workers_size; ++i) {
+		if (b.workers[i].thread)
+			pthread_join(b.workers[i].thread, NULL);
+		pthread_mutex_destroy(&b.workers[i].queue.lock);
+	}
+
+	int result = 1;
+	for (size_t i = 0; i < b.jobs_size; ++i) {
+		batch_job* job = &b.jobs[i];
+		fwrite(job->output, 1, job->output_size, stdout);
+		fprintf(stderr, "%s: exit %d, %.3f ms\n", job->path, job->status, job->milliseconds);
+		if (job->status != EXIT_SUCCESS)
+			result = 0;
+		free(job->output);
+		free(job->path);
+	}
+	fflush(stdout);
+
+	free(b.jobs);
+	free(b.workers);
+	return result;
+}
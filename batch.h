@@ -0,0 +1,17 @@
+#pragma once
+
+#include "interpret.h"
+
+typedef struct {
+	unsigned threads;    // 0 means one per online CPU
+	int use_cache;       // load and write .kyoc files, see cache.h
+	unsigned interleave; // programs each thread runs at once, taking turns
+	uint64_t slice;      // fuel of a turn when interleaving
+} batch_options;
+
+// runs every program in paths (directories contribute their .kyo files) on a
+// pool of worker threads, then prints the outputs to stdout in input order and
+// one line of exit status and timing per program to stderr. A program that
+// fails, overrunning its stack included, only fails its own job.
+// returns 1 when every program succeeded
+int run_batch(char* const* paths, size_t count, const batch_options* batch_options, const interpret_options* options);
@@ -0,0 +1,272 @@
+// kyou-bench: runs every program of the corpus under kyou, kyou with its
+// native tiers and as a kyouc binary, several times each, and prints wall
+// time, instructions per second, peak RSS and run to run variance as JSON.
+// A mode only counts when its output matches the one of plain kyou
+
+#include "cache.h"
+#include "file.h"
+#include "hash.h"
+#include "interpret.h"
+#include "optimize.h"
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define BENCH_DEFAULT_RUNS 5
+
+typedef struct {
+	const char* name;
+	const char* flags[3]; // for kyou, NULL terminated
+	int compiled; // run the kyouc binary instead
+} bench_mode;
+
+static const bench_mode modes[] = {
+	{ "kyou", { "--no-cache", NULL } },
+	{ "kyou --jit", { "--no-cache", "--jit", NULL } },
+	{ "kyou --trace", { "--no-cache", "--trace", NULL } },
+	{ "kyouc", { NULL }, 1 },
+};
+
+typedef struct {
+	int ok;
+	double milliseconds;
+	long peak_rss_kb;
+} run_result;
+
+static double now_milliseconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void discard(void* context, const char* data, size_t size)
+{
+	(void)context;
+	(void)data;
+	(void)size;
+}
+
+// instructions the interpreter dispatches for the program, superinstructions
+// counted by their parts, 0 when it does not run to its end
+static uint64_t count_instructions(const char* path)
+{
+	interpret_options options = { .optimize = 1, .inline_threshold = INLINE_DEFAULT_THRESHOLD, .fuse = 1 };
+	kyou_program program;
+	kyou_vm vm;
+	uint64_t count = 0;
+
+	if (!load_program_file(path, &options, 0, &program))
+		return 0;
+	if (vm_init(&vm, &program, discard, NULL, &options)) {
+		if (vm_run_budget(&vm, UINT64_MAX) == VM_HALTED)
+			count = UINT64_MAX - vm.budget;
+		vm_destroy(&vm);
+	}
+	program_free(&program);
+	return count;
+}
+
+// runs argv with its output written to output, /dev/null when NULL,
+// timing it and taking its peak RSS
+static run_result run(char* const* argv, const char* output)
+{
+	run_result result = { 0 };
+	double start = now_milliseconds();
+
+	pid_t pid = fork();
+	if (pid < 0)
+		return result;
+	if (pid == 0) {
+		int null = open("/dev/null", O_WRONLY);
+		int out = output ? open(output, O_WRONLY | O_TRUNC) : null;
+		dup2(out, STDOUT_FILENO);
+		dup2(null, STDERR_FILENO);
+		execv(argv[0], argv);
+		_exit(127);
+	}
+
+	int status;
+	struct rusage usage;
+	if (wait4(pid, &status, 0, &usage) != pid)
+		return result;
+
+	result.milliseconds = now_milliseconds() - start;
+	result.peak_rss_kb = usage.ru_maxrss;
+	result.ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+	return result;
+}
+
+static void json_string(FILE* file, const char* str)
+{
+	fputc('"', file);
+	for (; *str; ++str) {
+		if (*str == '"' || *str == '\\')
+			fputc('\\', file);
+		fputc(*str, file);
+	}
+	fputc('"', file);
+}
+
+static int hash_file(const char* path, uint64_t* hash)
+{
+	file_data file;
+
+	if (read_file(path, &file) != FILE_IO_SUCCESS)
+		return 0;
+	*hash = fnv1a(file.data, file.size);
+	file_data_free(&file);
+	return 1;
+}
+
+// expected is the hash of the output of plain kyou, set by the first mode
+static void bench_mode_run(FILE* file, const bench_mode* mode, const char* kyou, const char* kyouc, const char* path, unsigned runs, uint64_t instructions, uint64_t* expected)
+{
+	char binary[] = "/tmp/kyou-bench-XXXXXX";
+	char output[] = "/tmp/kyou-bench-XXXXXX";
+	char* argv[8];
+	size_t argc = 0;
+
+	fprintf(file, "        { \"mode\": ");
+	json_string(file, mode->name);
+
+	if (mode->compiled) {
+		int fd = mkstemp(binary);
+		if (fd < 0) {
+			fprintf(file, ", \"ok\": false, \"error\": \"could not create a temporary file\" }");
+			return;
+		}
+		close(fd);
+
+		char* compile[] = { (char*)kyouc, (char*)path, binary, NULL };
+		if (!run(compile, NULL).ok) {
+			unlink(binary);
+			fprintf(file, ", \"ok\": false, \"error\": \"kyouc could not compile the program\" }");
+			return;
+		}
+		argv[argc++] = binary;
+	} else {
+		argv[argc++] = (char*)kyou;
+		for (size_t i = 0; mode->flags[i]; ++i)
+			argv[argc++] = (char*)mode->flags[i];
+		argv[argc++] = (char*)path;
+	}
+	argv[argc] = NULL;
+
+	// one run to warm up the page cache and check the output, not counted
+	int fd = mkstemp(output);
+	if (fd < 0) {
+		if (mode->compiled)
+			unlink(binary);
+		fprintf(file, ", \"ok\": false, \"error\": \"could not create a temporary file\" }");
+		return;
+	}
+	close(fd);
+
+	run_result result = run(argv, output);
+	uint64_t hash;
+	int same = result.ok && hash_file(output, &hash) && (mode == &modes[0] ? (*expected = hash, 1) : hash == *expected);
+	unlink(output);
+	if (result.ok && !same) {
+		if (mode->compiled)
+			unlink(binary);
+		fprintf(file, ", \"ok\": false, \"error\": \"the output differs from kyou\" }");
+		return;
+	}
+
+	double sum = 0, sum_squares = 0, min = INFINITY, max = 0;
+	long peak_rss_kb = 0;
+	for (unsigned i = 0; i < runs && result.ok; ++i) {
+		result = run(argv, NULL);
+		sum += result.milliseconds;
+		sum_squares += result.milliseconds * result.milliseconds;
+		min = result.milliseconds < min ? result.milliseconds : min;
+		max = result.milliseconds > max ? result.milliseconds : max;
+		peak_rss_kb = result.peak_rss_kb > peak_rss_kb ? result.peak_rss_kb : peak_rss_kb;
+	}
+	if (mode->compiled)
+		unlink(binary);
+
+	if (!result.ok) {
+		fprintf(file, ", \"ok\": false, \"error\": \"the program failed\" }");
+		return;
+	}
+
+	double mean = sum / runs;
+	double variance = runs > 1 ? (sum_squares - sum * mean) / (runs - 1) : 0;
+	variance = variance > 0 ? variance : 0;
+	fprintf(file, ", \"ok\": true, \"wall_ms\": { \"mean\": %.3f, \"min\": %.3f, \"max\": %.3f, \"stddev\": %.3f, \"variance\": %.3f }",
+		mean, min, max, sqrt(variance), variance);
+	fprintf(file, ", \"instructions_per_second\": %.0f, \"peak_rss_kb\": %ld }", instructions / (mean / 1e3), peak_rss_kb);
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: kyou-bench --kyou path --kyouc path [--runs n] [--output file] programs...\n");
+}
+
+int main(int argc, char* argv[])
+{
+	const char* kyou = NULL;
+	const char* kyouc = NULL;
+	const char* output = NULL;
+	unsigned runs = BENCH_DEFAULT_RUNS;
+	char** paths = malloc(sizeof(char*) * argc);
+	size_t paths_size = 0;
+
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--kyou") == 0 && i + 1 < argc)
+			kyou = argv[++i];
+		else if (strcmp(argv[i], "--kyouc") == 0 && i + 1 < argc)
+			kyouc = argv[++i];
+		else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc)
+			runs = strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+			output = argv[++i];
+		else
+			paths[paths_size++] = argv[i];
+	}
+
+	if (!kyou || !kyouc || runs == 0 || paths_size == 0) {
+		usage();
+		free(paths);
+		return EXIT_FAILURE;
+	}
+
+	FILE* file = output ? fopen(output, "w") : stdout;
+	if (!file) {
+		fprintf(stderr, "error: could not open %s\n", output);
+		free(paths);
+		return EXIT_FAILURE;
+	}
+
+	fprintf(file, "{\n  \"runs\": %u,\n  \"benchmarks\": [\n", runs);
+	for (size_t i = 0; i < paths_size; ++i) {
+		fprintf(stderr, "%s\n", paths[i]);
+		uint64_t instructions = count_instructions(paths[i]);
+		uint64_t expected = 0;
+
+		fprintf(file, "    { \"program\": ");
+		json_string(file, paths[i]);
+		fprintf(file, ", \"instructions\": %llu, \"results\": [\n", (unsigned long long)instructions);
+		for (size_t j = 0; j < sizeof(modes) / sizeof(modes[0]); ++j) {
+			bench_mode_run(file, &modes[j], kyou, kyouc, paths[i], runs, instructions, &expected);
+			fprintf(file, j + 1 < sizeof(modes) / sizeof(modes[0]) ? ",\n" : "\n");
+		}
+		fprintf(file, "      ] }%s\n", i + 1 < paths_size ? "," : "");
+	}
+	fprintf(file, "  ]\n}\n");
+
+	if (output)
+		fclose(file);
+	free(paths);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,121 @@
+// kyou-bench-frontend: generates programs of the given numbers of lines and
+// times every front-end phase on them separately, results as JSON
+
+#include "ast.h"
+#include "file.h"
+#include "generate.h"
+#include "link.h"
+#include "tokens.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now_milliseconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+typedef struct {
+	size_t bytes, tokens, nodes;
+	double read_file, tokenize, build_ast, link_ast;
+} frontend_times;
+
+// build_ast tokenizes on its own, so its time includes a second tokenize
+static int time_frontend(const char* path, frontend_times* t)
+{
+	file_data file;
+	double start = now_milliseconds();
+	if (read_file(path, &file) != FILE_IO_SUCCESS) {
+		fprintf(stderr, "error: could not read %s\n", path);
+		return 0;
+	}
+	t->read_file = now_milliseconds() - start;
+	t->bytes = file.size;
+
+	tokens toks = { 0 };
+	symbol_table symbols = SYMBOL_TABLE_EMPTY;
+	start = now_milliseconds();
+	int result = tokenize(&toks, &symbols, (const char*)file.data, t->bytes) == TOKENIZE_SUCCESS;
+	t->tokenize = now_milliseconds() - start;
+	t->tokens = toks.size;
+	tokens_free(&toks);
+	symbols_free(&symbols);
+
+	AST ast;
+	start = now_milliseconds();
+	result = result && build_ast(&ast, file.data, t->bytes) == AST_SUCCESS;
+	t->build_ast = now_milliseconds() - start;
+	file_data_free(&file);
+	if (!result)
+		return 0;
+	t->nodes = ast.size;
+
+	start = now_milliseconds();
+	result = link_ast(&ast) == LINK_SUCCESS;
+	t->link_ast = now_milliseconds() - start;
+	ast_free(&ast);
+	return result;
+}
+
+int main(int argc, char* argv[])
+{
+	const char* output = NULL;
+	size_t* sizes = malloc(sizeof(size_t) * argc);
+	size_t sizes_size = 0;
+
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+			output = argv[++i];
+		else
+			sizes[sizes_size++] = strtoull(argv[i], NULL, 10);
+	}
+	if (sizes_size == 0) {
+		fprintf(stderr, "usage: kyou-bench-frontend [--output file] lines...\n");
+		free(sizes);
+		return EXIT_FAILURE;
+	}
+
+	FILE* file = output ? fopen(output, "w") : stdout;
+	if (!file) {
+		fprintf(stderr, "error: could not open %s\n", output);
+		free(sizes);
+		return EXIT_FAILURE;
+	}
+
+	int ok = 1;
+	fprintf(file, "{\n  \"frontend\": [\n");
+	for (size_t i = 0; i < sizes_size; ++i) {
+		char path[] = "/tmp/kyou-bench-frontend-XXXXXX";
+		int fd = mkstemp(path);
+		FILE* program = fd < 0 ? NULL : fdopen(fd, "w");
+		if (!program) {
+			fprintf(stderr, "error: could not create a temporary file\n");
+			ok = 0;
+			break;
+		}
+		generate_program(program, sizes[i]);
+		fclose(program);
+
+		fprintf(stderr, "%zu lines\n", sizes[i]);
+		frontend_times t = { 0 };
+		int result = time_frontend(path, &t);
+		unlink(path);
+
+		fprintf(file, "    { \"lines\": %zu, \"ok\": %s, \"bytes\": %zu, \"tokens\": %zu, \"nodes\": %zu, ",
+			sizes[i], result ? "true" : "false", t.bytes, t.tokens, t.nodes);
+		fprintf(file, "\"ms\": { \"read_file\": %.3f, \"tokenize\": %.3f, \"build_ast\": %.3f, \"link_ast\": %.3f } }%s\n",
+			t.read_file, t.tokenize, t.build_ast, t.link_ast, i + 1 < sizes_size ? "," : "");
+		ok = ok && result;
+	}
+	fprintf(file, "  ]\n}\n");
+
+	if (output)
+		fclose(file);
+	free(sizes);
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,41 @@
+#include "generate.h"
+
+static const char* digits[] = { "霊", "一", "二", "三", "四", "五", "六", "七", "八", "九" };
+
+// kanji numeral of n below a hundred
+static void write_number(FILE* file, unsigned n)
+{
+	if (n >= 10) {
+		if (n >= 20)
+			fputs(digits[n / 10], file);
+		fputs("十", file);
+		if (n % 10)
+			fputs(digits[n % 10], file);
+	} else {
+		fputs(digits[n], file);
+	}
+}
+
+void generate_program(FILE* file, size_t lines)
+{
+	size_t blocks = lines > 4 ? (lines - 4) / 6 : 0;
+
+	fputs("\t別札start常\n", file);
+	for (size_t i = 0; i < blocks; ++i) {
+		unsigned n = i % 100;
+
+		fprintf(file, "札f%zu\n\t火足", i);
+		write_number(file, n);
+		fputs("\n\t水動火\n", file);
+		fprintf(file, "\t別札f%zue火大", i);
+		write_number(file, n);
+		fprintf(file, "\n\t「generated line %zu」動日\n", i);
+		fprintf(file, "札f%zue\n\t帰\n", i);
+	}
+
+	// runs the first block, so the program halts after two lines of output
+	fputs("札start\n", file);
+	if (blocks)
+		fputs("\t呼札f0\n", file);
+	fputs("\t火動日\n", file);
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdio.h>
+
+// writes a valid kyou program of about lines lines to file: a label, a
+// local label, a string literal and a forward branch every six lines, so
+// the tokenizer, parser and linker all see machine-generated volume
+void generate_program(FILE* file, size_t lines);
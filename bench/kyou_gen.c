@@ -0,0 +1,28 @@
+// kyou-gen: writes a synthetic kyou program of the given number of lines
+// to stdout, or to a file, for front-end benchmarks and stress tests
+
+#include "generate.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2 || argc > 3) {
+		fprintf(stderr, "usage: kyou-gen lines [output]\n");
+		return EXIT_FAILURE;
+	}
+
+	FILE* file = argc == 3 ? fopen(argv[2], "w") : stdout;
+	if (!file) {
+		fprintf(stderr, "error: could not open %s\n", argv[2]);
+		return EXIT_FAILURE;
+	}
+
+	generate_program(file, strtoull(argv[1], NULL, 10));
+	if (file != stdout)
+		fclose(file);
+	else
+		fflush(stdout);
+	return EXIT_SUCCESS;
+}
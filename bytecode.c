@@ -0,0 +1,521 @@
+#include "bytecode.h"
+
+#include "hash.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+
+const char* opcode_names[] = {
+#define X(name) #name,
+	KYOU_OPCODES(X)
+#undef X
+#define X(a, b) #a " " #b,
+	KYOU_FUSED_PAIRS(X)
+#undef X
+#define X(a, b, c) #a " " #b " " #c,
+	KYOU_FUSED_TRIPLES(X)
+#undef X
+};
+
+typedef struct {
+	kyou_operand_t type;
+	uint8_t reg;
+	int64_t imm;
+} operand;
+
+typedef struct {
+	size_t insn;
+	size_t node;
+	enum { FIXUP_TARGET, FIXUP_IMMEDIATE } type;
+} fixup;
+
+typedef struct {
+	const AST* ast;
+	kyou_program* program;
+	size_t capacity;
+	kyou_position position; // of the node being lowered
+
+	fixup* fixups;
+	size_t fixups_size, fixups_capacity;
+
+	struct hash_table* interned; // AST string -> index in strings + 1
+	size_t string_data_capacity, strings_capacity, labels_capacity;
+} lowering;
+
+static kyou_insn* emit(lowering* l, kyou_opcode_t opcode)
+{
+	kyou_program* p = l->program;
+
+	if (p->size == l->capacity) {
+		l->capacity = l->capacity ? 2 * l->capacity : 64;
+		p->code = realloc(p->code, sizeof(kyou_insn) * l->capacity);
+		p->positions = realloc(p->positions, sizeof(kyou_position) * l->capacity);
+	}
+
+	p->positions[p->size] = l->position;
+	kyou_insn* insn = &p->code[p->size++];
+	*insn = (kyou_insn){ .opcode = opcode };
+	return insn;
+}
+
+static void add_fixup(lowering* l, size_t node, int type)
+{
+	if (l->fixups_size == l->fixups_capacity) {
+		l->fixups_capacity = l->fixups_capacity ? 2 * l->fixups_capacity : 16;
+		l->fixups = realloc(l->fixups, sizeof(fixup) * l->fixups_capacity);
+	}
+	l->fixups[l->fixups_size++] = (fixup){ .insn = l->program->size - 1, .node = node, .type = type };
+}
+
+// appends str to program->strings, returning its index
+static size_t add_string(lowering* l, const char* str)
+{
+	kyou_program* p = l->program;
+	size_t length = strlen(str);
+	if (p->string_data_size + length + 1 > l->string_data_capacity) {
+		while (p->string_data_size + length + 1 > l->string_data_capacity)
+			l->string_data_capacity = l->string_data_capacity ? 2 * l->string_data_capacity : 256;
+		p->string_data = realloc(p->string_data, l->string_data_capacity);
+	}
+	if (p->strings_size == l->strings_capacity) {
+		l->strings_capacity = l->strings_capacity ? 2 * l->strings_capacity : 16;
+		p->strings = realloc(p->strings, sizeof(kyou_string) * l->strings_capacity);
+	}
+
+	memcpy(p->string_data + p->string_data_size, str, length + 1);
+	p->strings[p->strings_size] = (kyou_string){ .offset = p->string_data_size, .length = length };
+	p->string_data_size += length + 1;
+	return p->strings_size++;
+}
+
+// index of str in program->strings, adding it the first time it is seen
+static size_t intern(lowering* l, const char* str)
+{
+	size_t index = (size_t)hash_get(l->interned, str);
+	if (index)
+		return index - 1;
+
+	index = add_string(l, str);
+	hash_add(l->interned, str, (void*)(index + 1));
+	return index;
+}
+
+static void add_label(lowering* l, uint32_t symbol)
+{
+	kyou_program* p = l->program;
+
+	// link_ast made sure every label is defined once, so no lookup is needed
+	size_t string = add_string(l, symbol_name(&l->ast->symbols, symbol));
+
+	if (p->labels_size == l->labels_capacity) {
+		l->labels_capacity = l->labels_capacity ? 2 * l->labels_capacity : 16;
+		p->labels = realloc(p->labels, sizeof(kyou_label) * l->labels_capacity);
+	}
+	p->labels[p->labels_size++] = (kyou_label){ .name = p->strings[string].offset, .pc = p->size };
+}
+
+// picks the flavour of a source opcode matching the operand kind
+static void set_operand(kyou_insn* insn, operand op)
+{
+	if (op.type == OPERAND_IMMEDIATE) {
+		insn->opcode += KYOU_SOURCE_OPCODE_COUNT;
+		insn->imm = op.imm;
+	} else {
+		insn->b = op.reg;
+	}
+}
+
+// evaluates memory addresses into a register or an immediate
+static int lower_address(const AST_address* addr, operand* out)
+{
+	switch (addr->type) {
+		case ADDRESS_REGISTER:
+			*out = (operand){ .type = OPERAND_REGISTER, .reg = addr->as_reg };
+			return 1;
+		case ADDRESS_IMMEDIATE:
+			*out = (operand){ .type = OPERAND_IMMEDIATE, .imm = addr->as_immediate };
+			return 1;
+		default:
+			fprintf(stderr, "error: address type %d can not be used as memory\n", addr->type);
+			return 0;
+	}
+}
+
+// memory sources are loaded into the scratch register first, so that
+// every instruction only has to deal with registers and immediates
+static int lower_source(lowering* l, const AST_source* src, operand* out)
+{
+	switch (src->type) {
+		case SOURCE_REGISTER:
+			*out = (operand){ .type = OPERAND_REGISTER, .reg = src->as_reg };
+			return 1;
+		case SOURCE_IMMEDIATE:
+			*out = (operand){ .type = OPERAND_IMMEDIATE, .imm = src->as_immediate };
+			return 1;
+		case SOURCE_NODE:
+			*out = (operand){ .type = OPERAND_IMMEDIATE, .imm = src->as_node };
+			return 2; // the caller has to register a fixup for the immediate
+		case SOURCE_MEM: {
+			operand addr;
+			if (!lower_address(&src->as_mem, &addr))
+				return 0;
+			kyou_insn* load = emit(l, OPCODE_LOAD_R);
+			load->a = REG_SCRATCH;
+			set_operand(load, addr);
+			*out = (operand){ .type = OPERAND_REGISTER, .reg = REG_SCRATCH };
+			return 1;
+		}
+		default:
+			fprintf(stderr, "error: source type %d is not implemented\n", src->type);
+			return 0;
+	}
+}
+
+// emits an instruction taking src as its operand, fixing up label values
+static kyou_insn* emit_with_source(lowering* l, kyou_opcode_t opcode, const AST_source* src)
+{
+	operand op;
+	int result = lower_source(l, src, &op);
+	if (!result)
+		return NULL;
+
+	kyou_insn* insn = emit(l, opcode);
+	set_operand(insn, op);
+	if (result == 2)
+		add_fixup(l, op.imm, FIXUP_IMMEDIATE);
+	return insn;
+}
+
+static int check_power(kyou_power_t power, const AST_destination* dest)
+{
+	if (power <= POWER_WINTER && dest->power <= POWER_WINTER && power > dest->power) {
+		fprintf(stderr, "error: source has bigger power than destination\n");
+		return 0;
+	}
+	return 1;
+}
+
+static kyou_opcode_t print_opcode(kyou_power_t power)
+{
+	switch (power) {
+		case POWER_STRING: return OPCODE_PRINT_STRING_R;
+		case POWER_CHAR: return OPCODE_PRINT_CHAR_R;
+		default: return OPCODE_PRINT_INT_R;
+	}
+}
+
+// stores whatever is in register reg into dest
+static int lower_store(lowering* l, const AST_destination* dest, uint8_t reg, kyou_power_t power)
+{
+	switch (dest->type) {
+		case DESTINATION_REGISTER:
+			if (dest->as_reg != reg) {
+				kyou_insn* move = emit(l, OPCODE_MOVE_R);
+				move->a = dest->as_reg;
+				set_operand(move, (operand){ .type = OPERAND_REGISTER, .reg = reg });
+			}
+			return 1;
+		case DESTINATION_FD:
+			if (dest->as_fd != 1) {
+				fprintf(stderr, "error: destination fd %d is not implemented\n", dest->as_fd);
+				return 0;
+			}
+			set_operand(emit(l, print_opcode(power)), (operand){ .type = OPERAND_REGISTER, .reg = reg });
+			return 1;
+		case DESTINATION_MEM: {
+			operand addr;
+			if (!lower_address(&dest->as_mem, &addr))
+				return 0;
+			kyou_insn* store = emit(l, OPCODE_STORE_R);
+			store->a = reg;
+			set_operand(store, addr);
+			return 1;
+		}
+		default:
+			fprintf(stderr, "error: unknown destination type %d\n", dest->type);
+			return 0;
+	}
+}
+
+static int lower_move(lowering* l, const AST_node* node)
+{
+	const AST_destination* dest = &node->move_dest;
+
+	if (!check_power(node->move_src.power, dest))
+		return 0;
+
+	switch (dest->type) {
+		case DESTINATION_REGISTER: {
+			kyou_insn* move = emit_with_source(l, OPCODE_MOVE_R, &node->move_src);
+			if (move == NULL)
+				return 0;
+			move->a = dest->as_reg;
+			return 1;
+		}
+		case DESTINATION_FD:
+			if (dest->as_fd != 1) {
+				fprintf(stderr, "error: destination fd %d is not implemented\n", dest->as_fd);
+				return 0;
+			}
+			return emit_with_source(l, print_opcode(node->move_src.power), &node->move_src) != NULL;
+		default: {
+			operand op;
+			int result = lower_source(l, &node->move_src, &op);
+			if (!result)
+				return 0;
+			if (op.type == OPERAND_IMMEDIATE) {
+				kyou_insn* move = emit(l, OPCODE_MOVE_R);
+				move->a = REG_SCRATCH;
+				set_operand(move, op);
+				if (result == 2)
+					add_fixup(l, op.imm, FIXUP_IMMEDIATE);
+				op = (operand){ .type = OPERAND_REGISTER, .reg = REG_SCRATCH };
+			}
+			return lower_store(l, dest, op.reg, node->move_src.power);
+		}
+	}
+}
+
+static int lower_op(lowering* l, const AST_node* node)
+{
+	kyou_opcode_t opcode;
+
+	switch (node->op_type) {
+		case OP_ADD: opcode = OPCODE_ADD_R; break;
+		case OP_SUB: opcode = OPCODE_SUB_R; break;
+		case OP_MUL: opcode = OPCODE_MUL_R; break;
+		case OP_DIV: opcode = OPCODE_DIV_R; break;
+		case OP_MOD: opcode = OPCODE_MOD_R; break;
+		default:
+			fprintf(stderr, "error: unknown operator type %d\n", node->op_type);
+			return 0;
+	}
+
+	kyou_insn* insn = emit_with_source(l, opcode, &node->op_src);
+	if (insn == NULL)
+		return 0;
+	insn->a = node->op_reg;
+	return 1;
+}
+
+static int compare(int type, int64_t a, int64_t b)
+{
+	switch (type) {
+		case BRANCH_EQUALS: return a == b;
+		case BRANCH_GREATER: return a > b;
+		case BRANCH_LESS: return a < b;
+		case BRANCH_GREATER_OR_EQ: return a >= b;
+		case BRANCH_LESS_OR_EQ: return a <= b;
+		default: return 0;
+	}
+}
+
+static int mirror(int type)
+{
+	switch (type) {
+		case BRANCH_GREATER: return BRANCH_LESS;
+		case BRANCH_LESS: return BRANCH_GREATER;
+		case BRANCH_GREATER_OR_EQ: return BRANCH_LESS_OR_EQ;
+		case BRANCH_LESS_OR_EQ: return BRANCH_GREATER_OR_EQ;
+		default: return type;
+	}
+}
+
+// emits a jump (or a call) to addr, returning the emitted instruction
+static kyou_insn* lower_jump(lowering* l, const AST_address* addr, kyou_opcode_t direct, kyou_opcode_t indirect)
+{
+	kyou_insn* insn;
+
+	switch (addr->type) {
+		case ADDRESS_NODE:
+			insn = emit(l, direct);
+			add_fixup(l, addr->as_node, FIXUP_TARGET);
+			return insn;
+		case ADDRESS_REGISTER:
+			insn = emit(l, indirect);
+			insn->a = addr->as_reg;
+			return insn;
+		default:
+			fprintf(stderr, "error: jumps to address type %d are not supported\n", addr->type);
+			return NULL;
+	}
+}
+
+static int lower_branch(lowering* l, const AST_node* node)
+{
+	if (node->branch_type == BRANCH_ALWAYS)
+		return lower_jump(l, &node->branch_addr, OPCODE_JUMP, OPCODE_JUMP_REG) != NULL;
+
+	if (node->branch_addr.type != ADDRESS_NODE) {
+		fprintf(stderr, "error: conditional branches need a label\n");
+		return 0;
+	}
+
+	operand a, b;
+	int type = node->branch_type;
+	int a_result = lower_source(l, &node->branch_a, &a);
+	if (!a_result)
+		return 0;
+
+	if (node->branch_a.type == SOURCE_MEM && node->branch_b.type == SOURCE_MEM) {
+		fprintf(stderr, "error: comparing two memory operands is not supported\n");
+		return 0;
+	}
+
+	int b_result = lower_source(l, &node->branch_b, &b);
+	if (!b_result)
+		return 0;
+
+	if (a_result == 2 || b_result == 2) {
+		fprintf(stderr, "error: labels can not be compared\n");
+		return 0;
+	}
+
+	if (a.type == OPERAND_IMMEDIATE && b.type == OPERAND_IMMEDIATE) {
+		// the outcome is known right away
+		if (compare(type, a.imm, b.imm)) {
+			emit(l, OPCODE_JUMP);
+			add_fixup(l, node->branch_addr.as_node, FIXUP_TARGET);
+		}
+		return 1;
+	}
+
+	if (a.type == OPERAND_IMMEDIATE) {
+		operand tmp = a;
+		a = b;
+		b = tmp;
+		type = mirror(type);
+	}
+
+	kyou_opcode_t opcode;
+	switch (type) {
+		case BRANCH_EQUALS: opcode = OPCODE_BRANCH_EQ_R; break;
+		case BRANCH_GREATER: opcode = OPCODE_BRANCH_GT_R; break;
+		case BRANCH_LESS: opcode = OPCODE_BRANCH_LT_R; break;
+		case BRANCH_GREATER_OR_EQ: opcode = OPCODE_BRANCH_GE_R; break;
+		case BRANCH_LESS_OR_EQ: opcode = OPCODE_BRANCH_LE_R; break;
+		default:
+			fprintf(stderr, "unknown branch type %d\n", type);
+			return 0;
+	}
+
+	kyou_insn* insn = emit(l, opcode);
+	insn->a = a.reg;
+	set_operand(insn, b);
+	add_fixup(l, node->branch_addr.as_node, FIXUP_TARGET);
+	return 1;
+}
+
+static int lower_pop(lowering* l, const AST_node* node)
+{
+	if (node->pop_to.type == DESTINATION_REGISTER) {
+		emit(l, OPCODE_POP)->a = node->pop_to.as_reg;
+		return 1;
+	}
+
+	emit(l, OPCODE_POP)->a = REG_SCRATCH;
+	return lower_store(l, &node->pop_to, REG_SCRATCH, node->pop_to.power);
+}
+
+static int lower_node(lowering* l, const AST_node* node)
+{
+	switch (node->type) {
+		case MOVE_STATEMENT:
+			return lower_move(l, node);
+		case OPERATOR_STATEMENT:
+			return lower_op(l, node);
+		case LABEL:
+			add_label(l, node->symbol);
+			return 1;
+		case BRANCH_STATEMENT:
+			return lower_branch(l, node);
+		case PUSH_STATEMENT:
+			return emit_with_source(l, OPCODE_PUSH_R, &node->push_from) != NULL;
+		case POP_STATEMENT:
+			return lower_pop(l, node);
+		case CALL_STATEMENT:
+			return lower_jump(l, &node->call_to, OPCODE_CALL, OPCODE_CALL_REG) != NULL;
+		case RETURN_STATEMENT:
+			emit(l, OPCODE_RETURN);
+			return 1;
+		case TEMP_STR_PRINT:
+			emit(l, OPCODE_PRINT_CONST)->imm = intern(l, node->id);
+			return 1;
+		default:
+			fprintf(stderr, "error: unknown statement type %d\n", node->type);
+			return 0;
+	}
+}
+
+lower_result_t lower_ast(const AST* ast, kyou_program* program)
+{
+	*program = (kyou_program){ 0 };
+	lowering l = {
+		.ast = ast,
+		.program = program,
+		.interned = hash_create(djb2, string_equals, 64)
+	};
+
+	// pc of the first instruction lowered from each node, labels lower
+	// to nothing and thus point at the instruction right after them
+	size_t* pc_of = malloc(sizeof(size_t) * (ast->size + 1));
+
+	for (size_t i = 0; i < ast->size; ++i) {
+		pc_of[i] = program->size;
+		l.position = (kyou_position){ ast->nodes[i].line, ast->nodes[i].col };
+		if (!lower_node(&l, &ast->nodes[i])) {
+			free(pc_of);
+			free(l.fixups);
+			hash_delete(l.interned);
+			program_free(program);
+			return LOWER_ERROR;
+		}
+	}
+	pc_of[ast->size] = program->size;
+	l.position = (kyou_position){ 0 };
+	emit(&l, OPCODE_HALT);
+
+	for (size_t i = 0; i < l.fixups_size; ++i) {
+		kyou_insn* insn = &program->code[l.fixups[i].insn];
+		if (l.fixups[i].type == FIXUP_TARGET)
+			insn->target = pc_of[l.fixups[i].node];
+		else
+			insn->imm = pc_of[l.fixups[i].node];
+	}
+
+	free(pc_of);
+	free(l.fixups);
+	hash_delete(l.interned);
+	return LOWER_SUCCESS;
+}
+
+void program_free(kyou_program* program)
+{
+	if (program->mapping) {
+		munmap(program->mapping, program->mapping_size);
+	} else {
+		free(program->code);
+		free(program->positions);
+		free(program->string_data);
+		free(program->strings);
+		free(program->labels);
+	}
+	*program = (kyou_program){ 0 };
+}
+
+size_t program_label_at(const kyou_program* program, size_t pc)
+{
+	size_t low = 0, high = program->labels_size;
+
+	while (low < high) {
+		size_t middle = low + (high - low) / 2;
+		if (program->labels[middle].pc <= pc)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return low;
+}
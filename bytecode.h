@@ -0,0 +1,122 @@
+#pragma once
+
+#include "ast.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// registers past the ones visible to programs, used by the lowering only
+#define REG_SCRATCH 7
+#define KYOU_REGISTER_COUNT 8
+
+// instructions taking a source operand get one opcode per operand kind:
+// NAME_R reads register b and NAME_I reads imm, so handlers never branch on it
+#define KYOU_SOURCE_OPCODES(X, S) \
+	X(MOVE##S) X(LOAD##S) X(STORE##S) \
+	X(ADD##S) X(SUB##S) X(MUL##S) X(DIV##S) X(MOD##S) \
+	X(PRINT_INT##S) X(PRINT_STRING##S) X(PRINT_CHAR##S) \
+	X(BRANCH_EQ##S) X(BRANCH_GT##S) X(BRANCH_LT##S) X(BRANCH_GE##S) X(BRANCH_LE##S) \
+	X(PUSH##S)
+
+#define KYOU_PLAIN_OPCODES(X) \
+	X(PRINT_CONST) \
+	X(JUMP) X(JUMP_REG) \
+	X(POP) X(CALL) X(CALL_REG) X(RETURN) \
+	X(HALT)
+
+#define KYOU_OPCODES(X) KYOU_SOURCE_OPCODES(X, _R) KYOU_SOURCE_OPCODES(X, _I) KYOU_PLAIN_OPCODES(X)
+
+// superinstructions, named after their parts joined by '_'; only the last
+// part may transfer control, the ones before it have to fall through
+#define KYOU_FUSED_PAIRS(X) \
+	X(MOVE_R, MOD_I) \
+	X(MOD_I, BRANCH_GT_I) \
+	X(ADD_I, BRANCH_LT_I) \
+	X(ADD_I, BRANCH_LT_R) \
+	X(PUSH_R, SUB_I) \
+	X(SUB_I, CALL) \
+	X(POP, ADD_R) \
+	X(ADD_R, RETURN) \
+	X(MOVE_I, RETURN)
+
+#define KYOU_FUSED_TRIPLES(X) \
+	X(MOVE_R, MOD_I, BRANCH_GT_I) \
+	X(PUSH_R, SUB_I, CALL) \
+	X(POP, ADD_R, RETURN)
+
+typedef enum {
+#define X(name) OPCODE_##name,
+	KYOU_OPCODES(X)
+#undef X
+#define X(a, b) OPCODE_##a##_##b,
+	KYOU_FUSED_PAIRS(X)
+#undef X
+#define X(a, b, c) OPCODE_##a##_##b##_##c,
+	KYOU_FUSED_TRIPLES(X)
+#undef X
+	OPCODE_COUNT
+} kyou_opcode_t;
+
+// distance between the register and the immediate flavour of an opcode
+#define KYOU_SOURCE_OPCODE_COUNT (OPCODE_MOVE_I - OPCODE_MOVE_R)
+
+typedef enum { OPERAND_REGISTER, OPERAND_IMMEDIATE } kyou_operand_t;
+
+// one lowered instruction, 16 bytes:
+//   a       - destination register, compared register or the value register of a store
+//   b/imm   - source operand of _R/_I opcodes respectively
+//   target  - pc of the jump target for branches and calls
+typedef struct {
+	uint8_t opcode;
+	uint8_t a;
+	uint8_t b;
+	uint32_t target;
+	int64_t imm;
+} kyou_insn;
+
+// program data only refers to other parts by offsets, so it can be stored
+// and mapped back as is, see cache.h
+typedef struct {
+	uint64_t offset; // of the NUL-terminated text in string_data
+	uint64_t length;
+} kyou_string;
+
+typedef struct {
+	uint64_t name; // offset in string_data
+	uint64_t pc;
+} kyou_label;
+
+// where the statement an instruction was lowered from starts, 0 for none
+typedef struct {
+	uint32_t line, col;
+} kyou_position;
+
+// a lowered program owns its code and strings and no longer needs the AST;
+// nothing writes to it while running, so VMs can share it
+typedef struct kyou_program {
+	kyou_insn* code;
+	size_t size;
+	kyou_position* positions; // one per instruction
+	char* string_data; // every distinct string once, strings and label names alike
+	size_t string_data_size;
+	kyou_string* strings;
+	size_t strings_size;
+	kyou_label* labels; // in order of their pc
+	size_t labels_size;
+	void* mapping; // the .kyoc everything above points into, NULL when lowered here
+	size_t mapping_size;
+} kyou_program;
+
+#define PROGRAM_STRING(program, i) ((program)->string_data + (program)->strings[i].offset)
+
+typedef enum { LOWER_SUCCESS, LOWER_ERROR } lower_result_t;
+
+extern const char* opcode_names[];
+
+// lowers a linked AST into a dense instruction stream; code addresses
+// (label values, return addresses) become instruction indices
+lower_result_t lower_ast(const AST* ast, kyou_program* program);
+void program_free(kyou_program* program);
+
+// the label whose code pc lies in as an index in labels plus one, 0 before the first one
+size_t program_label_at(const kyou_program* program, size_t pc);
@@ -0,0 +1,233 @@
+#include "cache.h"
+
+#include "ast.h"
+#include "file.h"
+#include "fuse.h"
+#include "hash.h"
+#include "link.h"
+#include "optimize.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define KYOC_ALIGN(x) (((x) + 15) & ~(uint64_t)15)
+
+// a section of count elements of size bytes lies within the file and is aligned
+static int section_valid(uint64_t offset, uint64_t count, size_t size, size_t file_size)
+{
+	return offset % 16 == 0 && offset <= file_size && count <= (file_size - offset) / size;
+}
+
+// the header only vouches for the sections, so everything the interpreter and
+// the JIT index with is checked once here instead of on every use
+static int program_valid(const kyou_program* program)
+{
+	const char* data = program->string_data;
+	size_t data_size = program->string_data_size;
+
+	if (program->size == 0)
+		return 0;
+
+	for (size_t pc = 0; pc < program->size; ++pc) {
+		const kyou_insn* insn = &program->code[pc];
+		if (insn->opcode >= OPCODE_COUNT || insn->a >= KYOU_REGISTER_COUNT || insn->b >= KYOU_REGISTER_COUNT
+			|| insn->target >= program->size || !fusion_intact(program, pc))
+			return 0;
+		if (insn->opcode == OPCODE_PRINT_CONST && (uint64_t)insn->imm >= program->strings_size)
+			return 0;
+	}
+
+	// the last instruction must not run on past the end of the code
+	switch (program->code[program->size - 1].opcode) {
+		case OPCODE_JUMP:
+		case OPCODE_JUMP_REG:
+		case OPCODE_RETURN:
+		case OPCODE_HALT:
+			break;
+		default:
+			return 0;
+	}
+
+	for (size_t i = 0; i < program->strings_size; ++i) {
+		const kyou_string* string = &program->strings[i];
+		if (string->offset >= data_size || string->length >= data_size - string->offset || data[string->offset + string->length] != '\0')
+			return 0;
+	}
+
+	for (size_t i = 0; i < program->labels_size; ++i) {
+		const kyou_label* label = &program->labels[i];
+		if (label->name >= data_size || !memchr(data + label->name, '\0', data_size - label->name)
+			|| label->pc >= program->size || (i > 0 && label->pc < program->labels[i - 1].pc))
+			return 0;
+	}
+
+	return 1;
+}
+
+cache_result_t cache_load(const char* path, uint64_t source_hash, size_t source_size, uint32_t flags, uint32_t inline_threshold, kyou_program* program)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return CACHE_MISS;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(kyoc_header)) {
+		close(fd);
+		return CACHE_MISS;
+	}
+
+	size_t size = st.st_size;
+	void* mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED)
+		return CACHE_ERROR;
+
+	const kyoc_header* h = mapping;
+	if (memcmp(h->magic, KYOC_MAGIC, 4) != 0 || h->version != KYOC_VERSION || h->opcode_count != OPCODE_COUNT
+		|| h->flags != flags || h->inline_threshold != inline_threshold || h->source_hash != source_hash || h->source_size != source_size
+		|| !section_valid(h->code_offset, h->code_size, sizeof(kyou_insn), size)
+		|| !section_valid(h->positions_offset, h->code_size, sizeof(kyou_position), size)
+		|| !section_valid(h->string_data_offset, h->string_data_size, 1, size)
+		|| !section_valid(h->strings_offset, h->strings_size, sizeof(kyou_string), size)
+		|| !section_valid(h->labels_offset, h->labels_size, sizeof(kyou_label), size)) {
+		munmap(mapping, size);
+		return CACHE_MISS;
+	}
+
+	char* base = mapping;
+	*program = (kyou_program){
+		.code = (kyou_insn*)(base + h->code_offset),
+		.size = h->code_size,
+		.positions = (kyou_position*)(base + h->positions_offset),
+		.string_data = base + h->string_data_offset,
+		.string_data_size = h->string_data_size,
+		.strings = (kyou_string*)(base + h->strings_offset),
+		.strings_size = h->strings_size,
+		.labels = (kyou_label*)(base + h->labels_offset),
+		.labels_size = h->labels_size,
+		.mapping = mapping,
+		.mapping_size = size
+	};
+	if (!program_valid(program)) {
+		munmap(mapping, size);
+		*program = (kyou_program){ 0 };
+		return CACHE_MISS;
+	}
+	return CACHE_SUCCESS;
+}
+
+static int write_section(FILE* file, const void* data, size_t size)
+{
+	static const char padding[16];
+
+	if (fwrite(data, 1, size, file) != size)
+		return 0;
+	return fwrite(padding, 1, KYOC_ALIGN(size) - size, file) == KYOC_ALIGN(size) - size;
+}
+
+cache_result_t cache_store(const char* path, uint64_t source_hash, size_t source_size, uint32_t flags, uint32_t inline_threshold, const kyou_program* program)
+{
+	kyoc_header h = {
+		.magic = KYOC_MAGIC,
+		.version = KYOC_VERSION,
+		.opcode_count = OPCODE_COUNT,
+		.flags = flags,
+		.inline_threshold = inline_threshold,
+		.source_hash = source_hash,
+		.source_size = source_size,
+		.code_size = program->size,
+		.string_data_size = program->string_data_size,
+		.strings_size = program->strings_size,
+		.labels_size = program->labels_size
+	};
+	h.code_offset = KYOC_ALIGN(sizeof(kyoc_header));
+	h.positions_offset = h.code_offset + KYOC_ALIGN(sizeof(kyou_insn) * h.code_size);
+	h.string_data_offset = h.positions_offset + KYOC_ALIGN(sizeof(kyou_position) * h.code_size);
+	h.strings_offset = h.string_data_offset + KYOC_ALIGN(h.string_data_size);
+	h.labels_offset = h.strings_offset + KYOC_ALIGN(sizeof(kyou_string) * h.strings_size);
+
+	char* temp_path = malloc(strlen(path) + 8);
+	sprintf(temp_path, "%s.XXXXXX", path);
+	int fd = mkstemp(temp_path);
+	if (fd < 0) {
+		free(temp_path);
+		return CACHE_ERROR;
+	}
+	fchmod(fd, 0644);
+
+	FILE* file = fdopen(fd, "wb");
+	int written = file
+		&& write_section(file, &h, sizeof(h))
+		&& write_section(file, program->code, sizeof(kyou_insn) * h.code_size)
+		&& write_section(file, program->positions, sizeof(kyou_position) * h.code_size)
+		&& write_section(file, program->string_data, h.string_data_size)
+		&& write_section(file, program->strings, sizeof(kyou_string) * h.strings_size)
+		&& write_section(file, program->labels, sizeof(kyou_label) * h.labels_size);
+	if (file ? fclose(file) != 0 : close(fd) != 0)
+		written = 0;
+
+	if (!written || rename(temp_path, path) != 0) {
+		unlink(temp_path);
+		free(temp_path);
+		return CACHE_ERROR;
+	}
+	free(temp_path);
+	return CACHE_SUCCESS;
+}
+
+int load_program_file(const char* path, const interpret_options* options, int use_cache, kyou_program* program)
+{
+	file_data file;
+	if (read_file(path, &file) != FILE_IO_SUCCESS) {
+		fprintf(stderr, "failed to read data from file %s!\n", path);
+		return 0;
+	}
+
+	// standard input has no place for a .kyoc next to it
+	use_cache = use_cache && strcmp(path, "-") != 0;
+
+	const unsigned char* data = file.data;
+	size_t data_size = file.size;
+	uint64_t hash = fnv1a(data, data_size);
+	char* cache_path = malloc(strlen(path) + 2);
+	sprintf(cache_path, "%sc", path);
+
+	uint32_t flags = (options->fuse ? KYOC_FUSED : 0) | (options->optimize ? KYOC_OPTIMIZED : 0);
+	uint32_t inline_threshold = options->optimize ? options->inline_threshold : 0;
+
+	// a dump needs the AST, which the cached program no longer has
+	if (use_cache && !options->dump_ast && cache_load(cache_path, hash, data_size, flags, inline_threshold, program) == CACHE_SUCCESS) {
+		free(cache_path);
+		file_data_free(&file);
+		return 1;
+	}
+
+	AST ast;
+	int result = build_ast(&ast, data, data_size) == AST_SUCCESS;
+	file_data_free(&file);
+	if (result) {
+		result = link_ast(&ast) == LINK_SUCCESS;
+		if (result && options->optimize)
+			optimize_ast(&ast, options->inline_threshold, 0);
+		if (result && options->dump_ast)
+			ast_dump(&ast, stderr);
+		result = result && lower_ast(&ast, program) == LOWER_SUCCESS;
+		ast_free(&ast);
+	}
+
+	if (result) {
+		if (options->fuse)
+			fuse_program(program);
+		// a directory we cannot write to only costs the next run its head start
+		if (use_cache)
+			cache_store(cache_path, hash, data_size, flags, inline_threshold, program);
+	}
+	free(cache_path);
+	return result;
+}
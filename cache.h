@@ -0,0 +1,46 @@
+#pragma once
+
+#include "bytecode.h"
+#include "interpret.h"
+
+// .kyoc files hold a linked program next to its source (fib.kyo -> fib.kyoc):
+// a header followed by the code, source positions, string data, string and label tables, each
+// 16-byte aligned and referenced by file offset, so the whole file is mapped
+// and used in place. A file is only used when the hash of the source, the
+// instruction layout and the passes run on it all match, and when every
+// opcode, register, jump target and table entry in it is in range.
+
+#define KYOC_MAGIC "KYOC"
+#define KYOC_VERSION 5
+
+// how the stored program was built
+#define KYOC_FUSED     1
+#define KYOC_OPTIMIZED 2
+
+typedef struct {
+	char magic[4];
+	uint32_t version;
+	uint32_t opcode_count; // OPCODE_COUNT, opcodes are renumbered when it changes
+	uint32_t flags; // KYOC_* flags
+	uint32_t inline_threshold; // of the optimizer, when KYOC_OPTIMIZED
+	uint32_t reserved;
+	uint64_t source_hash; // fnv1a of the source
+	uint64_t source_size;
+	uint64_t code_offset, code_size;
+	uint64_t positions_offset; // code_size of them
+	uint64_t string_data_offset, string_data_size;
+	uint64_t strings_offset, strings_size;
+	uint64_t labels_offset, labels_size;
+} kyoc_header;
+
+typedef enum { CACHE_SUCCESS, CACHE_MISS, CACHE_ERROR } cache_result_t;
+
+// maps path if it holds the program for a source with this hash and size
+cache_result_t cache_load(const char* path, uint64_t source_hash, size_t source_size, uint32_t flags, uint32_t inline_threshold, kyou_program* program);
+// writes program to path through a temporary file, so readers never see half of it
+cache_result_t cache_store(const char* path, uint64_t source_hash, size_t source_size, uint32_t flags, uint32_t inline_threshold, const kyou_program* program);
+
+// parses, links, optimizes and lowers the source at path, as options ask for;
+// with use_cache the program comes from its .kyoc when that is up to date,
+// which is rewritten otherwise
+int load_program_file(const char* path, const interpret_options* options, int use_cache, kyou_program* program);
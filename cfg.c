@@ -0,0 +1,158 @@
+#include "cfg.h"
+
+#include <stdlib.h>
+
+static int ends_block(const AST_node* node)
+{
+	return node->type == BRANCH_STATEMENT || node->type == CALL_STATEMENT || node->type == RETURN_STATEMENT;
+}
+
+int cfg_branch_taken(const AST_node* node, int* taken)
+{
+	const AST_source* a = &node->branch_a;
+	const AST_source* b = &node->branch_b;
+
+	if (node->branch_type == BRANCH_ALWAYS) {
+		*taken = 1;
+		return 1;
+	}
+	if (a->type != SOURCE_IMMEDIATE || b->type != SOURCE_IMMEDIATE)
+		return 0;
+
+	switch (node->branch_type) {
+		case BRANCH_EQUALS: *taken = a->as_immediate == b->as_immediate; return 1;
+		case BRANCH_GREATER: *taken = a->as_immediate > b->as_immediate; return 1;
+		case BRANCH_LESS: *taken = a->as_immediate < b->as_immediate; return 1;
+		case BRANCH_GREATER_OR_EQ: *taken = a->as_immediate >= b->as_immediate; return 1;
+		case BRANCH_LESS_OR_EQ: *taken = a->as_immediate <= b->as_immediate; return 1;
+		default: return 0;
+	}
+}
+
+static void add_edge(cfg* g, cfg_block* block, size_t node)
+{
+	block->succ[block->succ_size++] = g->block_of[node];
+}
+
+static void link_block(cfg* g, const AST* ast, cfg_block* block)
+{
+	const AST_node* last = &ast->nodes[block->end - 1];
+	int falls_through = 1;
+	int taken;
+
+	switch (last->type) {
+		case BRANCH_STATEMENT:
+			if (last->branch_addr.type != ADDRESS_NODE) {
+				block->exits = 1;
+			} else if (cfg_branch_taken(last, &taken)) {
+				if (taken) {
+					add_edge(g, block, last->branch_addr.as_node);
+					falls_through = 0;
+				}
+			} else {
+				add_edge(g, block, last->branch_addr.as_node);
+			}
+			if (last->branch_type == BRANCH_ALWAYS)
+				falls_through = 0;
+			break;
+		case CALL_STATEMENT:
+			if (last->call_to.type == ADDRESS_NODE)
+				add_edge(g, block, last->call_to.as_node);
+			else
+				block->exits = 1;
+			break;
+		case RETURN_STATEMENT:
+			block->exits = 1;
+			falls_through = 0;
+			break;
+		default:
+			break;
+	}
+
+	if (falls_through && block->end < ast->size)
+		add_edge(g, block, block->end);
+	else if (falls_through)
+		block->halts = 1;
+}
+
+static void mark_reachable(cfg* g, size_t start, size_t* stack)
+{
+	size_t size = 0;
+
+	if (g->blocks[start].reachable)
+		return;
+	g->blocks[start].reachable = 1;
+	stack[size++] = start;
+
+	while (size) {
+		cfg_block* block = &g->blocks[stack[--size]];
+		for (int i = 0; i < block->succ_size; ++i) {
+			cfg_block* next = &g->blocks[block->succ[i]];
+			if (!next->reachable) {
+				next->reachable = 1;
+				stack[size++] = next - g->blocks;
+			}
+		}
+	}
+}
+
+static int takes_address(const AST_source* src)
+{
+	return src->type == SOURCE_NODE;
+}
+
+void cfg_build(cfg* g, const AST* ast)
+{
+	*g = (cfg){ 0 };
+	if (ast->size == 0)
+		return;
+
+	g->block_of = malloc(sizeof(size_t) * ast->size);
+	g->blocks = malloc(sizeof(cfg_block) * ast->size);
+
+	for (size_t i = 0; i < ast->size; ++i) {
+		if (i == 0 || ast->nodes[i].type == LABEL || ends_block(&ast->nodes[i - 1])) {
+			if (g->size)
+				g->blocks[g->size - 1].end = i;
+			g->blocks[g->size++] = (cfg_block){ .begin = i };
+		}
+		g->block_of[i] = g->size - 1;
+	}
+	g->blocks[g->size - 1].end = ast->size;
+
+	for (size_t i = 0; i < g->size; ++i)
+		link_block(g, ast, &g->blocks[i]);
+
+	// returns and register jumps can only get to labels whose address was
+	// taken, or back behind a call, which the call edges cover already
+	size_t* stack = malloc(sizeof(size_t) * g->size);
+	mark_reachable(g, 0, stack);
+	for (size_t i = 0; i < ast->size; ++i) {
+		const AST_node* node = &ast->nodes[i];
+		const AST_source* src = NULL;
+
+		switch (node->type) {
+			case MOVE_STATEMENT: src = &node->move_src; break;
+			case OPERATOR_STATEMENT: src = &node->op_src; break;
+			case PUSH_STATEMENT: src = &node->push_from; break;
+			case BRANCH_STATEMENT:
+				if (node->branch_type == BRANCH_ALWAYS)
+					break;
+				if (takes_address(&node->branch_b))
+					mark_reachable(g, g->block_of[node->branch_b.as_node], stack);
+				src = &node->branch_a;
+				break;
+			default: break;
+		}
+		if (src && takes_address(src))
+			mark_reachable(g, g->block_of[src->as_node], stack);
+	}
+	free(stack);
+}
+
+void cfg_free(cfg* g)
+{
+	free(g->blocks);
+	free(g->block_of);
+	*g = (cfg){ 0 };
+}
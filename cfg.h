@@ -0,0 +1,27 @@
+#pragma once
+
+#include "ast.h"
+
+// control flow graph over the nodes of a linked AST. Blocks start at labels
+// and after branches, calls and returns; a call falls through to the node
+// after it, as that is where the callee returns to.
+typedef struct {
+	size_t begin, end; // nodes [begin, end)
+	size_t succ[2];
+	int succ_size;
+	int exits;     // ends in a return or a jump through a register, which may go anywhere
+	int halts;     // may run past the last node, which ends the program
+	int reachable; // from the start or from a label whose address is taken
+} cfg_block;
+
+typedef struct {
+	cfg_block* blocks;
+	size_t size;
+	size_t* block_of; // block of every node
+} cfg;
+
+void cfg_build(cfg* g, const AST* ast);
+// whether the branch node goes the same way every time, which is then stored
+// in taken: 1 for a 別 without condition or a condition between two immediates
+int cfg_branch_taken(const AST_node* node, int* taken);
+void cfg_free(cfg* g);
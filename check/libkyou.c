@@ -0,0 +1,253 @@
+// kyou-check: runs small programs through the embedding API of kyou.h and
+// compares what an embedder sees afterwards, exits non-zero on a mismatch
+
+#include "kyou.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/wait.h>
+
+static int failures;
+
+static void check(int ok, const char* name, const char* what)
+{
+	if (!ok) {
+		fprintf(stderr, "error: %s: %s\n", name, what);
+		++failures;
+	}
+}
+
+static void discard(void* context, const char* data, size_t size)
+{
+	(void)context;
+	(void)data;
+	(void)size;
+}
+
+// registers the program leaves behind must survive to kyou_get_register
+static void check_registers_after_run(unsigned flags)
+{
+	const char* name = "registers after run";
+	const char* source = "五動火\n三動水\n火足水\n";
+
+	kyou_program* program = kyou_load(source, strlen(source), flags);
+	check(program != NULL, name, "kyou_load failed");
+	if (!program)
+		return;
+	kyou_vm* vm = kyou_vm_create(program, discard, NULL, 0);
+	check(vm != NULL, name, "kyou_vm_create failed");
+	if (vm) {
+		check(kyou_run(vm, 0) == KYOU_HALTED, name, "kyou_run did not halt");
+		check(kyou_get_register(vm, KYOU_FIRE) == 8, name, "fire is not 8");
+		check(kyou_get_register(vm, KYOU_WATER) == 3, name, "water is not 3");
+		kyou_vm_destroy(vm);
+	}
+	kyou_unload(program);
+}
+
+// without load flags every step is one line of the source
+static void check_steps(void)
+{
+	const char* name = "steps";
+	const char* source = "五動火\n三動水\n火足水\n";
+
+	kyou_program* program = kyou_load(source, strlen(source), 0);
+	check(program != NULL, name, "kyou_load failed");
+	if (!program)
+		return;
+	kyou_vm* vm = kyou_vm_create(program, discard, NULL, 0);
+	check(vm != NULL, name, "kyou_vm_create failed");
+	if (vm) {
+		check(kyou_step(vm) == KYOU_PAUSED && kyou_pc(vm) == 1, name, "first step did not stop at 1");
+		check(kyou_step(vm) == KYOU_PAUSED && kyou_pc(vm) == 2, name, "second step did not stop at 2");
+		check(kyou_get_register(vm, KYOU_FIRE) == 5, name, "fire is not 5 before the last step");
+		kyou_vm_destroy(vm);
+	}
+	kyou_unload(program);
+}
+
+// an overflow fails the run instead of the process, and a reset VM runs again
+static void check_overflow(void)
+{
+	const char* name = "overflow";
+	const char* source = "札rec\n呼札rec\n";
+
+	kyou_program* program = kyou_load(source, strlen(source), 0);
+	check(program != NULL, name, "kyou_load failed");
+	if (!program)
+		return;
+	kyou_vm* vm = kyou_vm_create(program, discard, NULL, 4096);
+	check(vm != NULL, name, "kyou_vm_create failed");
+	if (vm) {
+		check(kyou_run(vm, 0) == KYOU_ERROR, name, "kyou_run did not fail");
+		kyou_vm_reset(vm);
+		check(kyou_run_fuel(vm, 100) == KYOU_PAUSED, name, "no run after kyou_vm_reset");
+		check(kyou_run_fuel(vm, 1000000) == KYOU_ERROR, name, "kyou_run_fuel did not fail");
+		kyou_vm_destroy(vm);
+	}
+	kyou_unload(program);
+}
+
+typedef struct {
+	char data[256];
+	size_t size;
+} captured;
+
+static void capture(void* context, const char* data, size_t size)
+{
+	captured* out = context;
+	if (size > sizeof(out->data) - out->size)
+		size = sizeof(out->data) - out->size;
+	memcpy(out->data + out->size, data, size);
+	out->size += size;
+}
+
+// output buffered before an overflow still reaches the sink
+static void check_output_before_overflow(void)
+{
+	const char* name = "output before overflow";
+	const char* source = "一動日\n札rec\n呼札rec\n";
+	captured out = { .size = 0 };
+
+	kyou_program* program = kyou_load(source, strlen(source), 0);
+	check(program != NULL, name, "kyou_load failed");
+	if (!program)
+		return;
+	kyou_vm* vm = kyou_vm_create(program, capture, &out, 4096);
+	check(vm != NULL, name, "kyou_vm_create failed");
+	if (vm) {
+		check(kyou_run(vm, 0) == KYOU_ERROR, name, "kyou_run did not fail");
+		check(out.size == 2 && memcmp(out.data, "1\n", 2) == 0, name, "1 was not printed");
+		kyou_vm_destroy(vm);
+	}
+	kyou_unload(program);
+}
+
+// what a whole run left behind, signal being the one that ended it or 0
+typedef struct {
+	int signal;
+	kyou_status status;
+	int64_t regs[KYOU_STORAGE];
+	captured out;
+} run_result;
+
+// loads and runs source in a child process, so a program that faults only
+// ends the child, and one that loops forever pauses once the budget is
+// used up; the result comes back through a pipe
+static int run_child(const char* source, unsigned flags, run_result* result)
+{
+	int fds[2];
+	if (pipe(fds) != 0)
+		return 0;
+
+	pid_t pid = fork();
+	if (pid < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		return 0;
+	}
+
+	if (pid == 0) {
+		run_result r = { 0 };
+		signal(SIGSEGV, SIG_DFL);
+		close(fds[0]);
+
+		kyou_program* program = kyou_load(source, strlen(source), flags);
+		kyou_vm* vm = program ? kyou_vm_create(program, capture, &r.out, 0) : NULL;
+		if (!vm)
+			_exit(EXIT_FAILURE);
+		r.status = kyou_run(vm, 10000000);
+		for (int reg = 0; reg < KYOU_STORAGE; ++reg)
+			r.regs[reg] = kyou_get_register(vm, reg);
+		_exit(write(fds[1], &r, sizeof(r)) == sizeof(r) ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+
+	close(fds[1]);
+	*result = (run_result){ 0 };
+	ssize_t size = read(fds[0], result, sizeof(*result));
+	close(fds[0]);
+
+	int status;
+	waitpid(pid, &status, 0);
+	if (WIFSIGNALED(status)) {
+		result->signal = WTERMSIG(status);
+		return 1;
+	}
+	return WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS && size == sizeof(*result);
+}
+
+// the AST passes and fusion must not change output, registers or how the
+// program ends; expected is the output of the unoptimized run
+static void check_optimized(const char* name, const char* source, const char* expected)
+{
+	run_result plain, optimized;
+
+	if (!run_child(source, 0, &plain) || !run_child(source, KYOU_LOAD_OPTIMIZE | KYOU_LOAD_FUSE, &optimized)) {
+		check(0, name, "could not run the program");
+		return;
+	}
+
+	check(plain.out.size == strlen(expected) && memcmp(plain.out.data, expected, plain.out.size) == 0, name, "unexpected output");
+	check(optimized.signal == plain.signal, name, "optimizing changed how the program ends");
+	check(optimized.status == plain.status, name, "optimizing changed the status");
+	check(memcmp(optimized.regs, plain.regs, sizeof(plain.regs)) == 0, name, "optimizing changed the registers");
+	check(optimized.out.size == plain.out.size && memcmp(optimized.out.data, plain.out.data, plain.out.size) == 0,
+		name, "optimizing changed the output");
+}
+
+static volatile sig_atomic_t host_faults;
+
+static void host_handler(int sig)
+{
+	(void)sig;
+	++host_faults;
+}
+
+// SIGSEGV the VM did not cause still reaches the handler of the host, which
+// has to be installed before the first run
+static void check_host_handler(void)
+{
+	const char* name = "host handler";
+	struct sigaction action = { .sa_handler = host_handler };
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGSEGV, &action, NULL);
+
+	check_overflow();
+	raise(SIGSEGV);
+	check(host_faults == 1, name, "SIGSEGV did not reach the host");
+}
+
+int main(void)
+{
+	check_host_handler();
+	check_registers_after_run(0);
+	check_registers_after_run(KYOU_LOAD_OPTIMIZE | KYOU_LOAD_FUSE);
+	check_steps();
+	check_output_before_overflow();
+
+	// a dead load from address 0 still faults
+	check_optimized("faulting load", "霊動火\n星火動水\n一動水\n水動日\n", "");
+	// a branch never taken to a label nothing else reaches
+	check_optimized("branch to a removed label", "一動火\n別札dead火大十\n火動日\n札dead\n二動日\n", "1\n2\n");
+	// fire is only 1 the first time the loop comes round, not at its label
+	check_optimized("fold across a label", "一動火\n札loop\n火足一\n別札loop火小五\n火動日\n", "5\n");
+	// constants known before a call are not known after it
+	check_optimized("fold across a call", "別札start常\n札set\n九動水\n帰\n札start\n一動水\n呼札set\n水足一\n水動日\n", "10\n");
+	// a leaf swapping fire and water through the stack is inlined
+	check_optimized("inlined push and pop", "別札start常\n札swap\n押火\n水動火\n弾水\n帰\n札start\n三動火\n四動水\n呼札swap\n火動日\n水動日\n", "4\n3\n");
+	// the 呼 right before the 帰 of down becomes a jump
+	check_optimized("tail call", "別札start常\n札down\n別札done水等霊\n水引一\n火足二\n呼札down\n帰\n札done\n帰\n札start\n五動水\n呼札down\n火動日\n", "10\n");
+	// a label whose address is taken stays, and so does what it does
+	check_optimized("call through a register", "別札start常\n札add3\n火足三\n帰\n札start\n札add3動水\n呼水\n呼水\n火動日\n", "6\n");
+
+	if (failures) {
+		fprintf(stderr, "%d checks failed\n", failures);
+		return EXIT_FAILURE;
+	}
+	printf("all checks passed\n");
+	return EXIT_SUCCESS;
+}
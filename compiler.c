@@ -1,7 +1,9 @@
 #include "ast.h"
 #include "file.h"
 #include "elf.h"
-#include "hash.h"
+#include "link.h"
+#include "optimize.h"
+#include "x64.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -9,93 +11,41 @@
 
 #include <sys/stat.h>
 
-static unsigned char* data;
-static size_t size;
-static size_t capacity;
-
-struct hash_table *relocs;
-
-//#define PTR(v) typeof(v*)
-#define EMIT(v) do {\
-	if (size + sizeof(v) >= capacity) {\
-		data = realloc(data, capacity + 4096);\
-		capacity += 4096;\
-	}\
-	*((typeof(&v))(data + size)) = v;\
-	size += sizeof(v);\
-} while(0)
-
-static uint8_t kyou_reg2x64id(kyou_register_t reg)
-{
-	switch (reg) {
-		case REG_FIRE:
-			return 3; //rbx
-		case REG_WATER:
-			return 12; //r12
-		case REG_TREE:
-			return 13; //r13
-		case REG_METAL:
-			return 14; //r14
-		case REG_EARTH:
-			return 15; //r15
-		case REG_STORAGE:
-			return 4; //rsp
-		case REG_STORAGE_BASE:
-			return 5; //rbp
-	}
-}
-
-static void emit_move_r2r(uint8_t reg1, uint8_t reg2)
-{
-	// 0100WRXB
-	uint8_t rex = 0x48 | (reg1 & 0x8 ? 0x1 : 0) | (reg2 & 0x8 ? 0x4 : 0);
-	uint8_t opcode = 0x89;
-	uint8_t modRM = 0xC0 | ((reg2 & 0x7) << 3) | (reg1 & 0x7);
-
-	EMIT(rex);
-	EMIT(opcode);
-	EMIT(modRM);
-}
-
-static void emit_move_imm2r(uint8_t reg, uint64_t imm)
-{
-	uint8_t rex = 0x48 | (reg & 0x8 ? 0x1 : 0);
-	uint8_t opcode = 0xB8 + (reg & 0x7);
-
-	EMIT(rex);
-	EMIT(opcode);
-	EMIT(imm);
-}
+static x64_buffer text;
 
 static int compile_syscall()
 {
-	emit_move_r2r(0, kyou_reg2x64id(REG_FIRE));
-	emit_move_r2r(7, kyou_reg2x64id(REG_WATER));
-	emit_move_r2r(6, kyou_reg2x64id(REG_TREE));
-	emit_move_r2r(2, kyou_reg2x64id(REG_METAL));
-	emit_move_r2r(10, kyou_reg2x64id(REG_EARTH));
+	emit_move_r2r(&text, 0, kyou_reg2x64id(REG_FIRE));
+	emit_move_r2r(&text, 7, kyou_reg2x64id(REG_WATER));
+	emit_move_r2r(&text, 6, kyou_reg2x64id(REG_TREE));
+	emit_move_r2r(&text, 2, kyou_reg2x64id(REG_METAL));
+	emit_move_r2r(&text, 10, kyou_reg2x64id(REG_EARTH));
 	// TODO: push 2 more args to stack if applicable
-	uint16_t opcode = 0x050f;
-	EMIT(opcode);
-	emit_move_r2r(kyou_reg2x64id(REG_FIRE), 0);
+	emit_syscall(&text);
+	emit_move_r2r(&text, kyou_reg2x64id(REG_FIRE), 0);
 }
 
 //rbx, r12, r13, r14, r15, rsp, rbp
 static int compile_move(AST_node* node)
 {
 	if (node->move_dest.type == DESTINATION_REGISTER && node->move_src.type == SOURCE_REGISTER) {
-		emit_move_r2r(kyou_reg2x64id(node->move_dest.as_reg), kyou_reg2x64id(node->move_src.as_reg));
+		emit_move_r2r(&text, kyou_reg2x64id(node->move_dest.as_reg), kyou_reg2x64id(node->move_src.as_reg));
 		return 1;
 	}
 	else if (node->move_dest.type == DESTINATION_REGISTER && node->move_src.type == SOURCE_IMMEDIATE) {
-		emit_move_imm2r(kyou_reg2x64id(node->move_dest.as_reg), node->move_src.as_immediate);
+		emit_move_imm2r(&text, kyou_reg2x64id(node->move_dest.as_reg), node->move_src.as_immediate);
 		return 1;
 	}
 	else if (node->move_dest.type == DESTINATION_FD && node->move_src.type == SOURCE_REGISTER) {
-		emit_move_imm2r(0, 60);
-		emit_move_r2r(7, kyou_reg2x64id(node->move_src.as_reg));
-		uint16_t opcode = 0x050f;
-		EMIT(opcode);
+		emit_move_imm2r(&text, 0, 60);
+		emit_move_r2r(&text, 7, kyou_reg2x64id(node->move_src.as_reg));
+		emit_syscall(&text);
+		return 1;
+	}
+	else if (node->move_dest.type == DESTINATION_FD && node->move_src.type == SOURCE_IMMEDIATE) {
+		emit_move_imm2r(&text, 0, 60);
+		emit_move_imm2r(&text, 7, node->move_src.as_immediate);
+		emit_syscall(&text);
 		return 1;
 	}
 	else {
@@ -104,38 +54,14 @@ static int compile_move(AST_node* node)
 	}
 }
 
-static void emit_add_r2r(uint8_t reg1, uint8_t reg2)
-{
-	uint8_t rex = 0x48 | (reg1 & 0x8 ? 0x1 : 0) | (reg2 & 0x8 ? 0x4 : 0);
-	uint8_t opcode = 0x01;
-	uint8_t modRM = 0xC0 | ((reg2 & 0x7) << 3) | (reg1 & 0x7);
-	
-	EMIT(rex);
-	EMIT(opcode);
-	EMIT(modRM);
-}
-
-static void emit_add_imm2r(uint8_t reg, uint64_t imm)
-{
-	uint32_t imm32 = (uint32_t)imm;
-	uint8_t rex = 0x48 | (reg & 0x8 ? 0x1 : 0);
-	uint8_t opcode = 0x81;
-	uint8_t modRM = 0xC0 | (reg & 0x7);
-
-	EMIT(rex);
-	EMIT(opcode);
-	EMIT(modRM);
-	EMIT(imm32);
-}
-
 static int compile_add(AST_node* node)
 {
 	if (node->op_src.type == SOURCE_REGISTER) {
-		emit_add_r2r(kyou_reg2x64id(node->op_reg), kyou_reg2x64id(node->op_src.as_reg));
+		emit_add_r2r(&text, kyou_reg2x64id(node->op_reg), kyou_reg2x64id(node->op_src.as_reg));
 		return 1;
 	}
 	else if (node->op_src.type == SOURCE_IMMEDIATE) {
-		emit_add_imm2r(kyou_reg2x64id(node->op_reg), node->op_src.as_immediate);
+		emit_add_imm2r(&text, kyou_reg2x64id(node->op_reg), node->op_src.as_immediate);
 		return 1;
 	}
 	else {
@@ -169,10 +95,9 @@ static int compile_start()
 
 static int compile_end()
 {
-	emit_move_imm2r(0, 60);
-	emit_move_imm2r(7, 0x0);
-	uint16_t opcode = 0x050f;
-	EMIT(opcode);
+	emit_move_imm2r(&text, 0, 60);
+	emit_move_imm2r(&text, 7, 0x0);
+	emit_syscall(&text);
 }
 
 int compile(AST* ast, const char* filename)
@@ -211,9 +136,7 @@ int compile(AST* ast, const char* filename)
 	text_header.p_paddr = 0x8048000;// + sizeof(elf_header) + sizeof(elf_program_header);
 	text_header.p_align = 0x1000;
 
-	capacity = 4096;
-	size = 0;
-	data = malloc(capacity);
+	text = (x64_buffer){ 0 };
 
 	compile_start();
 
@@ -233,14 +156,14 @@ int compile(AST* ast, const char* filename)
 
 	compile_end();
 
-	text_header.p_filesz = size + sizeof(elf_header) + sizeof(elf_program_header);
-	text_header.p_memsz = size + sizeof(elf_header) + sizeof(elf_program_header);
+	text_header.p_filesz = text.size + sizeof(elf_header) + sizeof(elf_program_header);
+	text_header.p_memsz = text.size + sizeof(elf_header) + sizeof(elf_program_header);
 
 	FILE* file = fopen(filename, "wb");
 	if (file) {
 		fwrite(&header, sizeof(elf_header), 1, file);
 		fwrite(&text_header, sizeof(elf_program_header), 1, file);
-		fwrite(data, 1, size, file);
+		fwrite(text.data, 1, text.size, file);
 	} else {
 		return -1;
 	}
@@ -254,23 +177,48 @@ int compile(AST* ast, const char* filename)
 
 int main(int argc, const char* argv[])
 {
-	unsigned char* data;
-	size_t data_size;
+	file_data file;
+	const char* files[2];
+	int files_size = 0;
+	int optimize = 1, dump_ast = 0;
+	size_t inline_threshold = INLINE_DEFAULT_THRESHOLD;
+
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--no-optimize") == 0)
+			optimize = 0;
+		else if (strcmp(argv[i], "--inline-threshold") == 0 && i + 1 < argc)
+			inline_threshold = strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--dump-ast") == 0)
+			dump_ast = 1;
+		else if (files_size < 2)
+			files[files_size++] = argv[i];
+	}
 
-	if (argc < 3) {
-		fprintf(stderr, "usage: kyouc [input] [output]\n");
+	if (files_size < 2) {
+		fprintf(stderr, "usage: kyouc [--no-optimize] [--inline-threshold n] [--dump-ast] [input] [output]\n");
 		return EXIT_FAILURE;
 	}
 
-	if (read_file(argv[1], &data, &data_size) != FILE_IO_SUCCESS) {
-		fprintf(stderr, "failed to read data from file %s!\n", argv[1]);
+	if (read_file(files[0], &file) != FILE_IO_SUCCESS) {
+		fprintf(stderr, "failed to read data from file %s!\n", files[0]);
 		return EXIT_FAILURE;
 	}
 
 	AST ast;
-	if (build_ast(&ast, data, data_size) != AST_SUCCESS) {
+	int built = build_ast(&ast, file.data, file.size) == AST_SUCCESS;
+	file_data_free(&file);
+	if (!built) {
 		return EXIT_FAILURE;
 	}
 
-	return compile(&ast, argv[2]);
-}
\ No newline at end of file
+	if (link_ast(&ast) != LINK_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+
+	if (optimize)
+		optimize_ast(&ast, inline_threshold, 0);
+	if (dump_ast)
+		ast_dump(&ast, stderr);
+
+	return compile(&ast, files[1]);
+}
@@ -1,37 +1,84 @@
 #include "file.h"
 
-#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
-static size_t file_length(FILE* file)
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define FILE_CHUNK_SIZE (64 * 1024)
+
+static file_io_result_t read_stream(int fd, file_data* file)
 {
-	size_t cur = ftell(file);
-	fseek(file, 0, SEEK_END);
-	size_t result = ftell(file);
-	fseek(file, cur, SEEK_SET);
-	return result;
+	unsigned char* data = NULL;
+	size_t size = 0, capacity = 0;
+
+	for (;;) {
+		if (capacity - size < FILE_CHUNK_SIZE) {
+			capacity = capacity ? 2 * capacity : FILE_CHUNK_SIZE;
+			unsigned char* grown = realloc(data, capacity);
+			if (grown == NULL) {
+				free(data);
+				return FILE_IO_READ_FAILURE;
+			}
+			data = grown;
+		}
+
+		// one byte stays free for the terminator
+		ssize_t count = read(fd, data + size, capacity - size - 1);
+		if (count < 0 && errno == EINTR)
+			continue;
+		if (count < 0) {
+			free(data);
+			return FILE_IO_READ_FAILURE;
+		}
+		if (count == 0)
+			break;
+		size += count;
+	}
+
+	data[size] = 0;
+	*file = (file_data){ .data = data, .size = size };
+	return FILE_IO_SUCCESS;
 }
 
-file_io_result_t read_file(const char* filename, unsigned char** buffer, size_t* size)
+file_io_result_t read_file(const char* filename, file_data* file)
 {
-	FILE* file = fopen(filename, "rb");
-
-	if (file == NULL)
-		return FILE_IO_NOT_FOUND;
-
-	*size = file_length(file);
-	*buffer = malloc(*size + 1);
-	(*buffer)[*size] = 0;
-	fread(*buffer, 1, *size, file);
-
-	if (ferror(file)) {
-		free(*buffer);
-		*buffer = NULL;
-		*size = 0;
-		fclose(file);
-		return FILE_IO_READ_FAILURE;
+	*file = (file_data){ 0 };
+
+	int from_stdin = strcmp(filename, "-") == 0;
+	int fd = from_stdin ? STDIN_FILENO : open(filename, O_RDONLY);
+	if (fd < 0)
+		return errno == ENOENT ? FILE_IO_NOT_FOUND : FILE_IO_OPEN_FAILURE;
+
+	// files that say they are empty may still have contents, like those in /proc
+	struct stat st;
+	file_io_result_t result = FILE_IO_SUCCESS;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		void* mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapping != MAP_FAILED) {
+			madvise(mapping, st.st_size, MADV_SEQUENTIAL);
+			*file = (file_data){ .data = mapping, .size = st.st_size, .mapped = 1 };
+		} else {
+			result = read_stream(fd, file);
+		}
+	} else {
+		result = read_stream(fd, file);
 	}
 
-	fclose(file);
-	return FILE_IO_SUCCESS;
+	if (!from_stdin)
+		close(fd);
+	return result;
+}
+
+void file_data_free(file_data* file)
+{
+	if (file->mapped)
+		munmap((void*)file->data, file->size);
+	else
+		free((void*)file->data);
+	*file = (file_data){ 0 };
 }
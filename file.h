@@ -4,4 +4,16 @@
 
 typedef enum { FILE_IO_SUCCESS, FILE_IO_NOT_FOUND, FILE_IO_OPEN_FAILURE, FILE_IO_READ_FAILURE } file_io_result_t;
 
-file_io_result_t read_file(const char* filename, unsigned char** buffer, size_t* size);
+// contents of a file as loaded by read_file: regular files are mapped
+// read-only, anything else is read into the heap. A mapping does not end
+// in a 0 byte, so readers must stay within size
+typedef struct {
+	const unsigned char* data;
+	size_t size;
+	int mapped;
+} file_data;
+
+// filename "-" reads standard input; pipes, terminals and other streams
+// are read in chunks until their end, so nothing has to seek
+file_io_result_t read_file(const char* filename, file_data* file);
+void file_data_free(file_data* file);
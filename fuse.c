@@ -0,0 +1,172 @@
+#include "fuse.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+const kyou_fusion fusion_table[] = {
+	// triples go first so that they win over the pairs they start with
+#define X(a, b, c) { OPCODE_##a##_##b##_##c, 3, { OPCODE_##a, OPCODE_##b, OPCODE_##c } },
+	KYOU_FUSED_TRIPLES(X)
+#undef X
+#define X(a, b) { OPCODE_##a##_##b, 2, { OPCODE_##a, OPCODE_##b } },
+	KYOU_FUSED_PAIRS(X)
+#undef X
+};
+
+const size_t fusion_table_size = sizeof(fusion_table) / sizeof(fusion_table[0]);
+
+const uint8_t opcode_unfused_table[256] = {
+#define X(name) [OPCODE_##name] = OPCODE_##name,
+	KYOU_OPCODES(X)
+#undef X
+#define X(a, b) [OPCODE_##a##_##b] = OPCODE_##a,
+	KYOU_FUSED_PAIRS(X)
+#undef X
+#define X(a, b, c) [OPCODE_##a##_##b##_##c] = OPCODE_##a,
+	KYOU_FUSED_TRIPLES(X)
+#undef X
+};
+
+const uint8_t opcode_fused_size_table[256] = {
+#define X(name) [OPCODE_##name] = 1,
+	KYOU_OPCODES(X)
+#undef X
+#define X(a, b) [OPCODE_##a##_##b] = 2,
+	KYOU_FUSED_PAIRS(X)
+#undef X
+#define X(a, b, c) [OPCODE_##a##_##b##_##c] = 3,
+	KYOU_FUSED_TRIPLES(X)
+#undef X
+};
+
+static const kyou_fusion* find_fusion(uint8_t opcode)
+{
+	for (size_t i = 0; i < fusion_table_size; ++i)
+		if (fusion_table[i].fused == opcode)
+			return &fusion_table[i];
+	return NULL;
+}
+
+
+int fusion_intact(const kyou_program* program, size_t pc)
+{
+	const kyou_fusion* f = find_fusion(program->code[pc].opcode);
+	if (!f)
+		return 1;
+	if (pc + f->size > program->size)
+		return 0;
+
+	for (size_t i = 1; i < f->size; ++i)
+		if (program->code[pc + i].opcode != f->parts[i])
+			return 0;
+	return 1;
+}
+
+int opcode_falls_through(uint8_t opcode)
+{
+	opcode = opcode_unfused(opcode);
+	if (opcode >= OPCODE_BRANCH_EQ_I && opcode <= OPCODE_BRANCH_LE_I)
+		opcode -= KYOU_SOURCE_OPCODE_COUNT;
+
+	switch (opcode) {
+		case OPCODE_BRANCH_EQ_R:
+		case OPCODE_BRANCH_GT_R:
+		case OPCODE_BRANCH_LT_R:
+		case OPCODE_BRANCH_GE_R:
+		case OPCODE_BRANCH_LE_R:
+		case OPCODE_JUMP:
+		case OPCODE_JUMP_REG:
+		case OPCODE_CALL:
+		case OPCODE_CALL_REG:
+		case OPCODE_RETURN:
+		case OPCODE_HALT:
+			return 0;
+		default:
+			return 1;
+	}
+}
+
+static int matches(const kyou_program* program, size_t pc, const kyou_fusion* f)
+{
+	if (pc + f->size > program->size)
+		return 0;
+
+	for (size_t i = 0; i < f->size; ++i)
+		if (program->code[pc + i].opcode != f->parts[i])
+			return 0;
+	return 1;
+}
+
+size_t fuse_program(kyou_program* program)
+{
+	size_t fused = 0;
+
+	for (size_t pc = 0; pc < program->size;) {
+		const kyou_fusion* f = NULL;
+		for (size_t i = 0; i < fusion_table_size && f == NULL; ++i)
+			if (matches(program, pc, &fusion_table[i]))
+				f = &fusion_table[i];
+
+		if (f == NULL) {
+			++pc;
+			continue;
+		}
+
+		program->code[pc].opcode = f->fused;
+		pc += f->size;
+		++fused;
+	}
+
+	return fused;
+}
+
+typedef struct {
+	uint8_t first, second;
+	size_t sites;
+	uint64_t executed;
+} sequence_stat;
+
+static int compare_stats(const void* a, const void* b)
+{
+	const sequence_stat* x = a;
+	const sequence_stat* y = b;
+	if (x->executed != y->executed)
+		return x->executed < y->executed ? 1 : -1;
+	return (x->sites < y->sites) - (x->sites > y->sites);
+}
+
+void fusion_report(const kyou_program* program, const uint64_t* counts)
+{
+	sequence_stat fused[OPCODE_COUNT] = { 0 };
+	sequence_stat* pairs = calloc(OPCODE_COUNT * OPCODE_COUNT, sizeof(sequence_stat));
+
+	for (size_t pc = 0; pc < program->size; ++pc) {
+		uint8_t opcode = program->code[pc].opcode;
+
+		if (opcode_fused_size(opcode) > 1) {
+			fused[opcode].first = opcode;
+			fused[opcode].sites++;
+			fused[opcode].executed += counts[pc];
+		} else if (opcode_falls_through(opcode) && pc + 1 < program->size) {
+			// whatever falls through runs the next instruction just as often
+			uint8_t next = opcode_unfused(program->code[pc + 1].opcode);
+			sequence_stat* pair = &pairs[opcode * OPCODE_COUNT + next];
+			pair->first = opcode;
+			pair->second = next;
+			pair->sites++;
+			pair->executed += counts[pc];
+		}
+	}
+
+	qsort(fused, OPCODE_COUNT, sizeof(sequence_stat), compare_stats);
+	fprintf(stderr, "fused sequences:\n");
+	for (size_t i = 0; i < OPCODE_COUNT && fused[i].sites; ++i)
+		fprintf(stderr, "  %-32s sites %6zu executed %12llu\n", opcode_names[fused[i].first], fused[i].sites, (unsigned long long)fused[i].executed);
+
+	qsort(pairs, OPCODE_COUNT * OPCODE_COUNT, sizeof(sequence_stat), compare_stats);
+	fprintf(stderr, "hottest unfused pairs:\n");
+	for (size_t i = 0; i < 10 && pairs[i].executed; ++i)
+		fprintf(stderr, "  %-15s %-16s sites %6zu executed %12llu\n", opcode_names[pairs[i].first], opcode_names[pairs[i].second], pairs[i].sites, (unsigned long long)pairs[i].executed);
+
+	free(pairs);
+}
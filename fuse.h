@@ -0,0 +1,44 @@
+#pragma once
+
+#include "bytecode.h"
+
+#include <stdint.h>
+
+typedef struct {
+	uint8_t fused;
+	uint8_t size;
+	uint8_t parts[3];
+} kyou_fusion;
+
+extern const kyou_fusion fusion_table[];
+extern const size_t fusion_table_size;
+
+// per opcode, built from the X-macros of bytecode.h: the first part of a
+// superinstruction or the opcode itself, and the number of its parts
+extern const uint8_t opcode_unfused_table[256];
+extern const uint8_t opcode_fused_size_table[256];
+
+// opcode of the first instruction a superinstruction was built from,
+// the rest of its parts are still in place right after it. The dispatch
+// loops ask on every instruction, so these are lookups and not searches
+static inline kyou_opcode_t opcode_unfused(uint8_t opcode)
+{
+	return opcode_unfused_table[opcode];
+}
+
+static inline size_t opcode_fused_size(uint8_t opcode)
+{
+	return opcode_fused_size_table[opcode];
+}
+// whether the instruction at pc is no superinstruction, or one whose parts
+// still follow it as fuse_program left them
+int fusion_intact(const kyou_program* program, size_t pc);
+// whether the instruction always continues with the next one
+int opcode_falls_through(uint8_t opcode);
+
+// replaces the first instruction of every matching sequence with a superinstruction;
+// the following instructions are kept as is, so jumps into the middle still work
+size_t fuse_program(kyou_program* program);
+
+// prints fused sites and the hottest remaining pairs, counts being per-pc execution counts
+void fusion_report(const kyou_program* program, const uint64_t* counts);
@@ -26,6 +26,19 @@ size_t djb2(const void* str)
 	return hash;
 }
 
+// FNV-1a over a whole buffer, for content hashes rather than table keys
+uint64_t fnv1a(const void* data, size_t size)
+{
+	const unsigned char* p = data;
+	uint64_t hash = UINT64_C(0xcbf29ce484222325);
+
+	for (size_t i = 0; i < size; ++i) {
+		hash ^= p[i];
+		hash *= UINT64_C(0x100000001b3);
+	}
+	return hash;
+}
+
 int string_equals(const void* a, const void* b)
 {
 	return strcmp((const char*)a, (const char*)b) == 0;
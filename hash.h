@@ -33,5 +33,6 @@ float hash_load_factor(struct hash_table* table);
 
 size_t djb2(const void*);
 size_t uint64_hash(const void*);
+uint64_t fnv1a(const void* data, size_t size);
 
 int string_equals(const void* a, const void* b);
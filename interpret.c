@@ -1,27 +1,18 @@
 ﻿#include "interpret.h"
 
-#include "hash.h"
+#include "fuse.h"
+#include "stack.h"
+#include "jit.h"
+#include "output.h"
+#include "profile.h"
+#include "sample.h"
+#include "trace.h"
 
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-
-const char* ast_names[] = {
-	"MOVE_STATEMENT",
-	"OPERATOR_STATEMENT",
-	"LABEL",
-	"BRANCH_STATEMENT",
-	"PUSH_STATEMENT",
-	"POP_STATEMENT",
-	"CALL_STATEMENT",
-	"RETURN_STATEMENT",
-	"STORE",
-	"TEMP_STR_PRINT"
-};
-
-int64_t regs[7] = { 0 };
-struct hash_table* labels;
-struct hash_table* strings;
+#include <string.h>
+#include <unistd.h>
 
 #define reg_stack_ptr regs[REG_STORAGE]
 #define reg_base_stack_ptr regs[REG_STORAGE_BASE]
@@ -29,283 +20,282 @@ struct hash_table* strings;
 #define STACK_PUSH(type, value) do { *((type*)(regs[REG_STORAGE])) = (value); regs[REG_STORAGE] += sizeof(type); } while (0)
 #define STACK_POP(type, var) do { regs[REG_STORAGE] -= sizeof(type); var = *((type*)(regs[REG_STORAGE])); } while (0)
 
-static int evaluate_address(AST_address* addr, void** value)
+// computed goto dispatch where the compiler has it, plain switch otherwise
+#if defined(__GNUC__) && !defined(KYOU_NO_COMPUTED_GOTO)
+#define KYOU_THREADED
+#endif
+
+#define NEXT do { ++pc; DISPATCH(); } while (0)
+#define JUMP(to) do { pc = code + (to); DISPATCH(); } while (0)
+#define SOURCE_R regs[pc->b]
+#define SOURCE_I pc->imm
+#define BRANCH(cond, src) do { if (regs[pc->a] cond src) LOOP(pc->target); NEXT; } while (0)
+#define CHECK_PC(to) if ((uint64_t)(to) >= size) { fprintf(stderr, "error: jump to %lld is outside of the program\n", (long long)(to)); return VM_ERROR; }
+
+// handlers for one operand kind of every source opcode, see KYOU_SOURCE_OPCODES
+#define SOURCE_HANDLERS(S) \
+	CASE(MOVE##S) regs[pc->a] = SOURCE##S; NEXT; \
+	CASE(LOAD##S) regs[pc->a] = *(int64_t*)SOURCE##S; NEXT; \
+	CASE(STORE##S) *(int64_t*)SOURCE##S = regs[pc->a]; NEXT; \
+	CASE(ADD##S) regs[pc->a] += SOURCE##S; NEXT; \
+	CASE(SUB##S) regs[pc->a] -= SOURCE##S; NEXT; \
+	CASE(MUL##S) regs[pc->a] *= SOURCE##S; NEXT; \
+	CASE(DIV##S) regs[pc->a] /= SOURCE##S; NEXT; \
+	CASE(MOD##S) regs[pc->a] %= SOURCE##S; NEXT; \
+	CASE(PRINT_INT##S) output_int(out, SOURCE##S); NEXT; \
+	CASE(PRINT_STRING##S) output_string(out, (const char*)SOURCE##S, strlen((const char*)SOURCE##S)); NEXT; \
+	CASE(PRINT_CHAR##S) output_char(out, (char)SOURCE##S); NEXT; \
+	CASE(BRANCH_EQ##S) BRANCH(==, SOURCE##S); \
+	CASE(BRANCH_GT##S) BRANCH(>, SOURCE##S); \
+	CASE(BRANCH_LT##S) BRANCH(<, SOURCE##S); \
+	CASE(BRANCH_GE##S) BRANCH(>=, SOURCE##S); \
+	CASE(BRANCH_LE##S) BRANCH(<=, SOURCE##S); \
+	CASE(PUSH##S) STACK_PUSH(int64_t, SOURCE##S); NEXT;
+
+// straight-line effects of the instructions that can lead a superinstruction
+#define EFFECT_MOVE_R(i) regs[(i)->a] = regs[(i)->b];
+#define EFFECT_MOVE_I(i) regs[(i)->a] = (i)->imm;
+#define EFFECT_ADD_R(i) regs[(i)->a] += regs[(i)->b];
+#define EFFECT_ADD_I(i) regs[(i)->a] += (i)->imm;
+#define EFFECT_SUB_I(i) regs[(i)->a] -= (i)->imm;
+#define EFFECT_MOD_I(i) regs[(i)->a] %= (i)->imm;
+#define EFFECT_PUSH_R(i) STACK_PUSH(int64_t, regs[(i)->b]);
+#define EFFECT_POP(i) STACK_POP(int64_t, regs[(i)->a]);
+
+#define KYOU_LOOP interpret_loop
+#include "interpret_loop.h"
+
+#define KYOU_LOOP interpret_loop_counting
+#define KYOU_COUNTING
+#include "interpret_loop.h"
+#undef KYOU_COUNTING
+
+#define KYOU_LOOP interpret_loop_tracing
+#define KYOU_TRACING
+#include "interpret_loop.h"
+#undef KYOU_TRACING
+
+#define KYOU_LOOP interpret_loop_budget
+#define KYOU_BUDGET
+#include "interpret_loop.h"
+#undef KYOU_BUDGET
+
+#define KYOU_LOOP interpret_loop_fuel
+#define KYOU_FUEL
+#include "interpret_loop.h"
+#undef KYOU_FUEL
+
+#define KYOU_LOOP interpret_loop_profiling
+#define KYOU_PROFILING
+#include "interpret_loop.h"
+#undef KYOU_PROFILING
+
+#define KYOU_LOOP interpret_loop_sampling
+#define KYOU_SAMPLING
+#include "interpret_loop.h"
+#undef KYOU_SAMPLING
+
+typedef vm_status_t (*interpret_loop_fn)(kyou_vm* vm, size_t start, uint64_t* counts, trace_cache* tracer, profiler* prof, sampler* samples);
+
+// runs loop until it returns or the storage stack overruns its guard pages,
+// which fails the run with VM_ERROR; either way the caller gets to clean up
+// and flush the output
+static vm_status_t run_guarded(interpret_loop_fn loop, kyou_vm* vm, size_t start, uint64_t* counts, trace_cache* tracer, profiler* prof, sampler* samples)
 {
-	switch (addr->type) {
-		case ADDRESS_REGISTER:
-			*value = &regs[addr->as_reg];
-			return 1;
-		case ADDRESS_LABEL:
-			*value = hash_get(labels, addr->as_label);
-			//fprintf(stderr, "address points to %p node\n", j);
-			if (*value == NULL) {
-				fprintf(stderr, "error: no such label %s\n", addr->as_label);
-				return 0;
-			} else {
-				*value += sizeof(AST_node);
-			}
-			return 1;
-		case ADDRESS_IMMEDIATE:
-			*value = (void*)addr->as_immediate;
-			return 1;
-		default:
-			fprintf(stderr, "error: unknown address type %d\n", addr->type);
-			return 0;
+	sigjmp_buf fault;
+	vm_status_t result = VM_ERROR;
+
+	switch (sigsetjmp(fault, 0)) {
+		case STACK_NO_FAULT:
+			stack_guard(&vm->stack, &fault);
+			result = loop(vm, start, counts, tracer, prof, samples);
+			break;
+		case STACK_OVERFLOW:
+			fprintf(stderr, "error: stack overflow\n");
+			break;
+		case STACK_UNDERFLOW:
+			fprintf(stderr, "error: stack underflow\n");
+			break;
 	}
+	stack_unguard();
+	return result;
 }
 
-static int evaluate_source(AST_source* src, int64_t* value)
+// jit_run the same way, 0 when the stack overran
+static int run_jit_guarded(const kyou_jit* jit, kyou_vm* vm, size_t start, int64_t* resume)
 {
-	switch (src->type) {
-		case SOURCE_REGISTER:
-			*value = regs[src->as_reg];
-			return 1;
-		case SOURCE_IMMEDIATE:
-			*value = src->as_immediate;
-			return 1;
-		case SOURCE_MEM:
-			if (!evaluate_address(&src->as_mem, (void**)&value))
-				return 0;
-			*value = *((int64_t*)(*value));
-			return 1;
-		case SOURCE_LABEL:
-			*value = (int64_t)hash_get(labels, src->as_label);
-			if (*((int64_t*)value) == 0) {
-				fprintf(stderr, "error: no such label %s\n", src->as_label);
-				return 0;
-			}
-			return 1;
-		default:
-			fprintf(stderr, "error: source type %d is not implemented\n", src->type);
-			return 0;
+	sigjmp_buf fault;
+	int ran = 0;
+
+	switch (sigsetjmp(fault, 0)) {
+		case STACK_NO_FAULT:
+			stack_guard(&vm->stack, &fault);
+			*resume = jit_run(jit, vm->regs, start);
+			ran = 1;
+			break;
+		case STACK_OVERFLOW:
+			fprintf(stderr, "error: stack overflow\n");
+			break;
+		case STACK_UNDERFLOW:
+			fprintf(stderr, "error: stack underflow\n");
+			break;
 	}
+	stack_unguard();
+	return ran;
 }
 
-static int evaluate_destination(AST_destination* dest, int64_t value, kyou_power_t power)
+static vm_status_t run_program(kyou_vm* vm, const interpret_options* options)
 {
-	if (power <= POWER_WINTER && dest->power <= POWER_WINTER && power > dest->power) {
-		fprintf(stderr, "error: source has bigger power than destination\n");
-		return 0;
+	const kyou_program* program = vm->program;
+	size_t start = vm->pc;
+
+	// the profile covers the whole run, so it leaves out the native tiers
+	if (options->profile) {
+		profiler prof;
+		profiler_init(&prof, program);
+		vm_status_t result = run_guarded(interpret_loop_profiling, vm, start, NULL, NULL, &prof, NULL);
+		profile_report(&prof, stderr);
+		profiler_free(&prof);
+		return result;
 	}
 
-	switch (dest->type) {
-		case DESTINATION_REGISTER:
-			if (dest->as_reg > 7) {
-				fprintf(stderr, "error: bad register id %d\n", dest->as_reg);
-				return 0;
-			}
+	if (options->sample_path) {
+		FILE* file = fopen(options->sample_path, "w");
+		if (!file) {
+			fprintf(stderr, "error: could not open %s\n", options->sample_path);
+			return VM_ERROR;
+		}
 
-			regs[dest->as_reg] = value;
-			return 1;
-		case DESTINATION_FD: 
-			if (dest->as_fd == 1) {
-				if (power <= POWER_WINTER) printf("%lld\n", value);
-				if (power == POWER_STRING) printf("%s\n", (const char*)value);
-				if (power == POWER_CHAR) printf("%c\n", (char)value);
-				return 1;
-			} else {
-				fprintf(stderr, "error: destination fd %d is not implemented\n", dest->as_fd);
-				return 0;
-			}
-		case DESTINATION_MEM: {
-			int64_t* addr;
-			if (!evaluate_address(&dest->as_mem, (void**)&addr))
-				return 0;
-			*addr = value;
-			}
-			return 1;
-		default:
-			fprintf(stderr, "error: unknown destination type %d\n", dest->type);
-			return 0;
+		sampler samples;
+		vm_status_t result = VM_ERROR;
+		if (sampler_start(&samples, program, &vm->stack, options->sample_rate) == SAMPLE_SUCCESS) {
+			result = run_guarded(interpret_loop_sampling, vm, start, NULL, NULL, NULL, &samples);
+			sampler_stop(&samples);
+			sampler_write(&samples, file);
+		}
+		sampler_free(&samples);
+		fclose(file);
+		return result;
 	}
-}
 
-static int interpret_move(AST_node* node)
-{
-	int64_t value;
+	if (options->jit) {
+		kyou_jit jit;
+		if (jit_compile(program, &vm->output, &jit) == JIT_SUCCESS) {
+			int64_t resume;
+			int ran = run_jit_guarded(&jit, vm, start, &resume);
+			jit_free(&jit);
+
+			if (!ran)
+				return VM_ERROR;
+			if (resume == JIT_HALTED)
+				return VM_HALTED;
+			if (resume == JIT_BAD_JUMP) {
+				fprintf(stderr, "error: jump outside of the program\n");
+				return VM_ERROR;
+			}
+			start = resume;
+		} else {
+			fprintf(stderr, "falling back to the interpreter\n");
+		}
+	}
 
-	if (!evaluate_source(&node->move_src, &value))
-		return 0;
+	if (options->fusion_stats) {
+		uint64_t* counts = calloc(program->size, sizeof(uint64_t));
+		vm_status_t result = run_guarded(interpret_loop_counting, vm, start, counts, NULL, NULL, NULL);
+		fusion_report(program, counts);
+		free(counts);
+		return result;
+	}
 
-	if (!evaluate_destination(&node->move_dest, value, node->move_src.power))
-		return 0;
+	if (options->trace && !options->jit) {
+		trace_cache tracer;
+		trace_cache_init(&tracer, program, &vm->output, options->trace_threshold);
+		vm_status_t result = run_guarded(interpret_loop_tracing, vm, start, NULL, &tracer, NULL, NULL);
+		trace_cache_free(&tracer);
+		return result;
+	}
 
-	return 1;
+	return run_guarded(interpret_loop, vm, start, NULL, NULL, NULL, NULL);
 }
 
-static int interpret_op(AST_node* node)
+int vm_init(kyou_vm* vm, const kyou_program* program, output_sink sink, void* context, const interpret_options* options)
 {
-	int64_t* reg = &regs[node->op_reg];
-	int64_t value;
-
-	if (!evaluate_source(&node->op_src, &value))
+	if (stack_create(&vm->stack, options->stack_size ? options->stack_size : STACK_DEFAULT_SIZE) != STACK_SUCCESS)
 		return 0;
 
-	switch (node->op_type) {
-		case OP_ADD: *reg += value; break;
-		case OP_SUB: *reg -= value; break;
-		case OP_MUL: *reg *= value; break;
-		case OP_DIV: *reg /= value; break;
-		case OP_MOD: *reg %= value; break;
-		default:
-			fprintf(stderr, "error: unknown operator type %d\n", node->op_type);
-			return 0;
-	}
-
+	vm->program = program;
+	output_init(&vm->output, sink, context, options->flush_lines);
+	vm_reset(vm);
 	return 1;
 }
 
-static int interpret_branch(AST_node* node, AST_node** i)
+void vm_reset(kyou_vm* vm)
 {
-	AST_node* j;
-	int64_t a;
-	int64_t b;
-
-	if (!evaluate_address(&node->branch_addr, (void**)&j))
-		return 0;
-
-	if (node->branch_addr.type == ADDRESS_LABEL)
-		j -= 1; // the loop will advance the node, TODO: maybe continue; if branch is successful?
-
-	if (node->branch_type == BRANCH_ALWAYS) {
-		*i = j;
-	} else {
-		if (!evaluate_source(&node->branch_a, &a) || !(evaluate_source(&node->branch_b, &b)))
-			return 0;
-
-		switch (node->branch_type) {
-			case BRANCH_EQUALS:
-				if (a == b) *i = j;
-				break;
-			case BRANCH_GREATER:
-				if (a > b) *i = j;
-				break;
-			case BRANCH_GREATER_OR_EQ:
-				if (a >= b) *i = j;
-				break;
-			case BRANCH_LESS:
-				if (a < b) *i = j;
-				break;
-			case BRANCH_LESS_OR_EQ:
-				if (a <= b) *i = j;
-				break;
-			default:
-				fprintf(stderr, "unknown branch type %d\n", node->branch_type);
-				return 0;
-		}
-	}
-
-	return 1;
+	memset(vm->regs, 0, sizeof(vm->regs));
+	vm->regs[REG_STORAGE] = (int64_t)vm->stack.base;
+	vm->regs[REG_STORAGE_BASE] = (int64_t)vm->stack.base;
+	vm->pc = 0;
+	vm->budget = 0;
+	vm->fuel = 0;
 }
 
-int interpret_push(AST_node* node)
+vm_status_t vm_run(kyou_vm* vm, const interpret_options* options)
 {
-	int64_t value;
-
-	if (!evaluate_source(&node->push_from, &value))
-		return 0;
-
-	STACK_PUSH(int64_t, value);
-
-	return 1;
+	vm_status_t result = run_program(vm, options);
+	output_flush(&vm->output);
+	return result;
 }
 
-int interpret_pop(AST_node* node)
+vm_status_t vm_run_budget(kyou_vm* vm, uint64_t budget)
 {
-	int64_t value;
-
-	STACK_POP(int64_t, value);
-
-	if (!evaluate_destination(&node->pop_to, value, node->pop_to.power))
-		return 0;
-
-	return 1;
+	vm->budget = budget;
+	vm_status_t result = run_guarded(interpret_loop_budget, vm, vm->pc, NULL, NULL, NULL, NULL);
+	output_flush(&vm->output);
+	return result;
 }
 
-int interpret_call(AST_node* node, AST_node** i)
+vm_status_t vm_run_fuel(kyou_vm* vm, uint64_t fuel)
 {
-	AST_node* j;
-
-	if (!evaluate_address(&node->call_to, (void**)&j))
-		return 0;
-
-	if (node->call_to.type == ADDRESS_LABEL)
-		--j;
-
-	STACK_PUSH(AST_node*, node);
-	*i = j;
-
-	return 1;
+	vm->fuel = fuel;
+	vm_status_t result = run_guarded(interpret_loop_fuel, vm, vm->pc, NULL, NULL, NULL, NULL);
+	output_flush(&vm->output);
+	return result;
 }
 
-int interpret_return(AST_node* node, AST_node** i)
+void vm_destroy(kyou_vm* vm)
 {
-	STACK_POP(AST_node*, *i);
-	return 1;
+	stack_destroy(&vm->stack);
 }
 
-int interpret_ast(AST ast)
+int interpret_program(const kyou_program* program, const interpret_options* options)
 {
-	labels = hash_create(djb2, string_equals, 16);
-
-	for (size_t i = 0; i < ast.size; ++i) {
-		//fprintf(stderr, "%s\n", ast_names[ast.nodes[i].type]);
-		if (ast.nodes[i].type == LABEL) {
-			if (hash_get(labels, ast.nodes[i].id) == NULL) {
-				//fprintf(stderr, "added label %s with ptr %p\n", ast.nodes[i].id, &ast.nodes[i]);
-				hash_add(labels, ast.nodes[i].id, &ast.nodes[i]);
-			} else {
-				fprintf(stderr, "error: same label %s declared twice\n", ast.nodes[i].id);
-				return 0;
-			}
-		}
+	kyou_vm* vm = malloc(sizeof(kyou_vm));
+	if (!vm) {
+		fprintf(stderr, "error: failed to allocate VM\n");
+		return 0;
 	}
 
-	int64_t *stack = malloc(sizeof(int64_t) * 32);
-	regs[REG_STORAGE] = (int64_t)stack;
-	regs[REG_STORAGE_BASE] = (int64_t)stack;
-
-	for (AST_node* node = &ast.nodes[0]; node != &ast.nodes[ast.size]; ++node) {
-		//fprintf(stderr, "will execute node type %d\n", node->type);
-		switch (node->type) {
-			case MOVE_STATEMENT:
-				if (!interpret_move(node))
-					return 0;
-				break;
-			case OPERATOR_STATEMENT:
-				if (!interpret_op(node))
-					return 0;
-				break;
-			case LABEL:
-				//fprintf(stderr, "skipped label\n");
-				break;
-			case BRANCH_STATEMENT:
-				if (!interpret_branch(node, &node))
-					return 0;
-				break;
-			case PUSH_STATEMENT:
-				if (!interpret_push(node))
-					return 0;
-				break;
-			case POP_STATEMENT:
-				if (!interpret_pop(node))
-					return 0;
-				break;
-			case CALL_STATEMENT:
-				if (!interpret_call(node, &node))
-					return 0;
-				break;
-			case RETURN_STATEMENT:
-				if (!interpret_return(node, &node))
-					return 0;
-				break;
-			case TEMP_STR_PRINT:
-				printf("%s\n", node->id);
-				break;
-			default:
-				fprintf(stderr, "error: unknown statement type %d\n", node->type);
-				return 0;
-		}
+	int result = 0;
+	if (vm_init(vm, program, output_fd_sink, FD_CONTEXT(STDOUT_FILENO), options)) {
+		result = vm_run(vm, options) == VM_HALTED;
+		vm_destroy(vm);
 	}
-	return 1;
+	free(vm);
+	return result;
+}
+
+int interpret_ast(AST ast, const interpret_options* options)
+{
+	kyou_program program;
+
+	// labels are expected to be resolved by link_ast beforehand
+	if (lower_ast(&ast, &program) != LOWER_SUCCESS)
+		return 0;
+
+	if (options->fuse)
+		fuse_program(&program);
+
+	int result = interpret_program(&program, options);
+	program_free(&program);
+	return result;
 }
@@ -1,5 +1,53 @@
 #pragma once
 
 #include "ast.h"
+#include "bytecode.h"
+#include "output.h"
+#include "stack.h"
 
-int interpret_ast(AST ast);
+typedef struct {
+	int optimize;     // run the AST passes of optimize.h after linking
+	size_t inline_threshold; // largest leaf label inlined by optimize_ast, 0 for none
+	int dump_ast;     // print the AST to stderr once it is optimized
+	int fuse;         // build superinstructions before running
+	int fusion_stats; // count executions and report fused sequences at exit
+	int profile;      // count every instruction, time every label and report both at exit
+	const char* sample_path; // write folded stacks sampled sample_rate times a second there
+	unsigned sample_rate;
+	int jit;          // run natively, falling back to the interpreter where needed
+	int trace;        // compile hot loops only, once they jumped back trace_threshold times
+	unsigned trace_threshold;
+	size_t stack_size; // bytes, STACK_DEFAULT_SIZE when 0
+	size_t flush_lines; // flush output every n lines, 0 only when the buffer is full
+} interpret_options;
+
+int interpret_program(const kyou_program* program, const interpret_options* options);
+int interpret_ast(AST ast, const interpret_options* options);
+
+typedef enum { VM_ERROR, VM_HALTED, VM_PAUSED } vm_status_t;
+
+// state of one running program. Everything mutable lives here, so any number of
+// VMs can run at once on different threads; the program itself is only read
+// and can be shared between them once it is lowered and fused
+typedef struct kyou_vm {
+	int64_t regs[KYOU_REGISTER_COUNT];
+	const kyou_program* program;
+	size_t pc;       // where the next run starts, kept up to date when paused or halted
+	uint64_t budget; // instructions left for vm_run_budget
+	uint64_t fuel;   // roughly the instructions left for vm_run_fuel
+	kyou_stack stack;
+	kyou_output output;
+} kyou_vm;
+
+// sets up registers, storage stack and an output flushing into sink
+int vm_init(kyou_vm* vm, const kyou_program* program, output_sink sink, void* context, const interpret_options* options);
+// back to the first instruction with cleared registers and an empty stack
+void vm_reset(kyou_vm* vm);
+// runs from vm->pc on the calling thread until the program halts or fails
+vm_status_t vm_run(kyou_vm* vm, const interpret_options* options);
+// runs at most budget instructions, superinstructions count as their parts
+vm_status_t vm_run_budget(kyou_vm* vm, uint64_t budget);
+// runs until about fuel instructions ran, checking only at backward jumps and
+// calls, then yields with VM_PAUSED; the next run resumes where it stopped
+vm_status_t vm_run_fuel(kyou_vm* vm, uint64_t fuel);
+void vm_destroy(kyou_vm* vm);
@@ -0,0 +1,207 @@
+// dispatch loop of the interpreter, included by interpret.c once per flavour:
+// KYOU_LOOP names the function, KYOU_COUNTING adds per-pc execution counts,
+// KYOU_TRACING runs hot loops through the tracing JIT, KYOU_BUDGET pauses
+// once vm->budget instructions ran, KYOU_FUEL yields once vm->fuel is used up,
+// KYOU_PROFILING counts every instruction and follows calls for --profile and
+// KYOU_SAMPLING takes the samples of --sample
+
+#ifdef KYOU_COUNTING
+#define COUNT() ++counts[pc - code]
+#elif defined(KYOU_PROFILING)
+#define COUNT() ++prof->counts[pc - code]
+#elif defined(KYOU_TRACING)
+#define COUNT() if (tracer->recording) trace_record(tracer, pc - code)
+#elif defined(KYOU_BUDGET)
+#define COUNT() if (vm->budget == 0) { vm->pc = pc - code; return VM_PAUSED; } --vm->budget
+#else
+#define COUNT() (void)0
+#endif
+
+#ifdef KYOU_FUEL
+// fuel is charged with the straight run of instructions since the last jump
+// target, but only at backward jumps and calls, the only ways to run forever
+#define CHARGE(to) do {\
+	if ((size_t)(to) <= (size_t)(pc - code)) {\
+		fuel -= pc - mark + 1;\
+		if (fuel <= 0) {\
+			vm->fuel = 0;\
+			vm->pc = (to);\
+			return VM_PAUSED;\
+		}\
+	}\
+	mark = code + (to);\
+} while (0)
+#define CHARGE_CALL(to) do {\
+	fuel -= pc - mark + 1;\
+	mark = code + (to);\
+	if (fuel <= 0) {\
+		vm->fuel = 0;\
+		vm->pc = (to);\
+		return VM_PAUSED;\
+	}\
+} while (0)
+#elif defined(KYOU_SAMPLING)
+// every way to run for long passes a taken jump or a call, so checking there
+// is enough and keeps straight-line code as fast as in the plain loop
+#define CHARGE(to) do {\
+	if (samples->pending)\
+		sampler_take(samples, pc - code, (const int64_t*)regs[REG_STORAGE]);\
+} while (0)
+#define CHARGE_CALL(to) CHARGE(to)
+#else
+#define CHARGE(to) (void)0
+#define CHARGE_CALL(to) (void)0
+#endif
+
+#ifdef KYOU_TRACING
+#define LOOP(to) do {\
+	if ((size_t)(to) <= (size_t)(pc - code)) {\
+		const kyou_jit* trace = trace_loop_head(tracer, (to));\
+		if (trace) {\
+			target = jit_run_trace(trace, regs);\
+			if (target == JIT_HALTED)\
+				return VM_HALTED;\
+			CHECK_PC(target);\
+			JUMP(target);\
+		}\
+	}\
+	JUMP(to);\
+} while (0)
+#else
+#define LOOP(to) do { CHARGE(to); JUMP(to); } while (0)
+#endif
+
+#if defined(KYOU_BUDGET) || defined(KYOU_PROFILING)
+// counting single instructions, so superinstructions only run their first part
+#define OPCODE(pc) opcode_unfused((pc)->opcode)
+#else
+#define OPCODE(pc) (pc)->opcode
+#endif
+
+#ifdef KYOU_PROFILING
+#define PROFILE_CALL(to) profile_call(prof, (to))
+#define PROFILE_RETURN() profile_return(prof)
+#elif defined(KYOU_SAMPLING)
+#define PROFILE_CALL(to) sampler_call(samples, (const int64_t*)regs[REG_STORAGE] - 1)
+#define PROFILE_RETURN() (void)0
+#else
+#define PROFILE_CALL(to) (void)0
+#define PROFILE_RETURN() (void)0
+#endif
+
+#ifdef KYOU_THREADED
+#define DISPATCH() do { COUNT(); goto *dispatch_table[OPCODE(pc)]; } while (0)
+#define CASE(name) op_##name:
+#else
+// the labels are only there for the fused handlers to continue at their last
+// part, most of them are never jumped to
+#ifdef __GNUC__
+#define CASE(name) case OPCODE_##name: op_##name: __attribute__((unused))
+#else
+#define CASE(name) case OPCODE_##name: op_##name:
+#endif
+#define DISPATCH() do { COUNT(); goto dispatch; } while (0)
+#endif
+
+static vm_status_t KYOU_LOOP(kyou_vm* vm, size_t start, uint64_t* counts, trace_cache* tracer, profiler* prof, sampler* samples)
+{
+	int64_t* const regs = vm->regs;
+	kyou_output* const out = &vm->output;
+	const kyou_program* program = vm->program;
+	const kyou_insn* code = program->code;
+	const kyou_insn* pc = code + start;
+	const size_t size = program->size;
+	int64_t target;
+#ifdef KYOU_FUEL
+	int64_t fuel = vm->fuel > INT64_MAX ? INT64_MAX : (int64_t)vm->fuel;
+	const kyou_insn* mark = pc;
+#endif
+
+	(void)counts;
+	(void)tracer;
+	(void)prof;
+	(void)samples;
+
+#ifdef KYOU_THREADED
+	static void* dispatch_table[] = {
+#define X(name) &&op_##name,
+		KYOU_OPCODES(X)
+#undef X
+#define X(a, b) &&op_##a##_##b,
+		KYOU_FUSED_PAIRS(X)
+#undef X
+#define X(a, b, c) &&op_##a##_##b##_##c,
+		KYOU_FUSED_TRIPLES(X)
+#undef X
+	};
+#endif
+
+	DISPATCH();
+
+#ifndef KYOU_THREADED
+dispatch:
+	switch (OPCODE(pc)) {
+#endif
+	SOURCE_HANDLERS(_R)
+	SOURCE_HANDLERS(_I)
+
+	CASE(PRINT_CONST) output_string(out, PROGRAM_STRING(program, pc->imm), program->strings[pc->imm].length); NEXT;
+
+	CASE(JUMP) LOOP(pc->target);
+	CASE(JUMP_REG)
+		target = regs[pc->a];
+		CHECK_PC(target);
+		CHARGE(target);
+		JUMP(target);
+
+	CASE(POP) STACK_POP(int64_t, regs[pc->a]); NEXT;
+	CASE(CALL)
+		STACK_PUSH(int64_t, pc - code + 1);
+		PROFILE_CALL(pc->target);
+		CHARGE_CALL(pc->target);
+		JUMP(pc->target);
+	CASE(CALL_REG)
+		target = regs[pc->a];
+		CHECK_PC(target);
+		STACK_PUSH(int64_t, pc - code + 1);
+		PROFILE_CALL(target);
+		CHARGE_CALL(target);
+		JUMP(target);
+	CASE(RETURN)
+		STACK_POP(int64_t, target);
+		CHECK_PC(target);
+		PROFILE_RETURN();
+		CHARGE(target);
+		JUMP(target);
+
+	CASE(HALT)
+		vm->pc = pc - code;
+		return VM_HALTED;
+
+	// superinstructions run the leading parts inline and then jump straight
+	// into the handler of the last part, which does its own dispatch
+#define X(a, b) CASE(a##_##b) EFFECT_##a(pc) ++pc; goto op_##b;
+	KYOU_FUSED_PAIRS(X)
+#undef X
+#define X(a, b, c) CASE(a##_##b##_##c) EFFECT_##a(pc) EFFECT_##b(pc + 1) pc += 2; goto op_##c;
+	KYOU_FUSED_TRIPLES(X)
+#undef X
+
+#ifndef KYOU_THREADED
+	default:
+		fprintf(stderr, "error: unknown opcode %d\n", pc->opcode);
+		return VM_ERROR;
+	}
+#endif
+}
+
+#undef LOOP
+#undef CHARGE
+#undef CHARGE_CALL
+#undef PROFILE_CALL
+#undef PROFILE_RETURN
+#undef CASE
+#undef DISPATCH
+#undef COUNT
+#undef OPCODE
+#undef KYOU_LOOP
@@ -1,31 +1,129 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
-#include "file.h"
-#include "ast.h"
+#include "cache.h"
 #include "interpret.h"
+#include "optimize.h"
+#include "sample.h"
+#include "batch.h"
+
+static size_t parse_size(const char* str)
+{
+	char* end;
+	size_t size = strtoul(str, &end, 10);
+
+	if (*end == 'k' || *end == 'K')
+		size *= 1024;
+	else if (*end == 'm' || *end == 'M')
+		size *= 1024 * 1024;
+	return size;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: kyou [options] [file]    file - reads the program from standard input\n");
+	fprintf(stderr, "       kyou --batch [options] [files or directories...]\n");
+	fprintf(stderr, "  --no-optimize   do not fold constants, inline or remove dead code\n");
+	fprintf(stderr, "  --dump-ast      print the optimized AST to stderr\n");
+	fprintf(stderr, "  --inline-threshold [n] inline leaf labels of up to n statements, 0 for none (default %d)\n", INLINE_DEFAULT_THRESHOLD);
+	fprintf(stderr, "  --no-fuse       do not build superinstructions\n");
+	fprintf(stderr, "  --fusion-stats  report fused sequences and how often they ran\n");
+	fprintf(stderr, "  --profile       report the hottest labels and instructions at exit\n");
+	fprintf(stderr, "  --sample [file]        write call stacks sampled while running to file, folded for flame graphs\n");
+	fprintf(stderr, "  --sample-rate [n]      samples per second of CPU time (default %d)\n", SAMPLE_DEFAULT_RATE);
+	fprintf(stderr, "  --jit           compile the program to native code before running it\n");
+	fprintf(stderr, "  --trace         compile hot loops to native code while running\n");
+	fprintf(stderr, "  --trace-threshold [n]  iterations before a loop is traced (default 50)\n");
+	fprintf(stderr, "  --stack-size [n]       size of the storage stack in bytes, K and M suffixes allowed (default 1M)\n");
+	fprintf(stderr, "  --flush-lines [n]      flush output every n lines (default: when full, or every line on a terminal)\n");
+	fprintf(stderr, "  --line-buffered        flush output after every line\n");
+	fprintf(stderr, "  --no-cache             neither use nor write the compiled .kyoc next to the source\n");
+	fprintf(stderr, "  --batch                run many programs on all cores, outputs in input order\n");
+	fprintf(stderr, "  --threads [n]          worker threads for --batch (default: one per CPU)\n");
+	fprintf(stderr, "  --interleave [n]       programs each --batch thread runs at once, taking turns (default 1)\n");
+	fprintf(stderr, "  --slice [n]            instructions of a turn when interleaving (default 100000)\n");
+}
 
 int main(int argc, char* argv[])
 {
-	unsigned char* data;
-	size_t data_size;
+	const char* filename = NULL;
+	char** paths = malloc(sizeof(char*) * argc);
+	size_t paths_size = 0;
+	int batch = 0;
+	batch_options batch_options = { .use_cache = 1, .interleave = 1, .slice = 100000 };
+	interpret_options options = { .optimize = 1, .inline_threshold = INLINE_DEFAULT_THRESHOLD, .fuse = 1, .trace_threshold = 50, .flush_lines = isatty(STDOUT_FILENO) };
 
-	if (argc < 2) {
-		fprintf(stderr, "usage: kyou [file]\n");
-		return EXIT_FAILURE;
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--no-optimize") == 0) {
+			options.optimize = 0;
+		} else if (strcmp(argv[i], "--inline-threshold") == 0 && i + 1 < argc) {
+			options.inline_threshold = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--dump-ast") == 0) {
+			options.dump_ast = 1;
+		} else if (strcmp(argv[i], "--no-fuse") == 0) {
+			options.fuse = 0;
+		} else if (strcmp(argv[i], "--fusion-stats") == 0) {
+			options.fusion_stats = 1;
+		} else if (strcmp(argv[i], "--profile") == 0) {
+			options.profile = 1;
+		} else if (strcmp(argv[i], "--sample") == 0 && i + 1 < argc) {
+			options.sample_path = argv[++i];
+		} else if (strcmp(argv[i], "--sample-rate") == 0 && i + 1 < argc) {
+			options.sample_rate = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--jit") == 0) {
+			options.jit = 1;
+		} else if (strcmp(argv[i], "--trace") == 0) {
+			options.trace = 1;
+		} else if (strcmp(argv[i], "--trace-threshold") == 0 && i + 1 < argc) {
+			options.trace_threshold = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--stack-size") == 0 && i + 1 < argc) {
+			options.stack_size = parse_size(argv[++i]);
+		} else if (strcmp(argv[i], "--flush-lines") == 0 && i + 1 < argc) {
+			options.flush_lines = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--line-buffered") == 0) {
+			options.flush_lines = 1;
+		} else if (strcmp(argv[i], "--no-cache") == 0) {
+			batch_options.use_cache = 0;
+		} else if (strcmp(argv[i], "--batch") == 0) {
+			batch = 1;
+		} else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+			batch_options.threads = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--interleave") == 0 && i + 1 < argc) {
+			batch_options.interleave = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--slice") == 0 && i + 1 < argc) {
+			batch_options.slice = strtoull(argv[++i], NULL, 10);
+		} else if (argv[i][0] == '-' && argv[i][1] == '-') {
+			fprintf(stderr, "unknown option %s\n", argv[i]);
+			usage();
+			return EXIT_FAILURE;
+		} else {
+			filename = argv[i];
+			paths[paths_size++] = argv[i];
+		}
+	}
+
+	if (batch) {
+		if (paths_size == 0) {
+			usage();
+			return EXIT_FAILURE;
+		}
+		return run_batch(paths, paths_size, &batch_options, &options) ? EXIT_SUCCESS : EXIT_FAILURE;
 	}
 
-	if (read_file(argv[1], &data, &data_size) != FILE_IO_SUCCESS) {
-		fprintf(stderr, "failed to read data from file %s!\n", argv[1]);
+	if (filename == NULL) {
+		usage();
 		return EXIT_FAILURE;
 	}
 
-	AST ast;
-	if (build_ast(&ast, data, data_size) != AST_SUCCESS) {
+	kyou_program program;
+	if (!load_program_file(filename, &options, batch_options.use_cache, &program)) {
 		return EXIT_FAILURE;
 	}
 
-	interpret_ast(ast);
+	int result = interpret_program(&program, &options);
+	program_free(&program);
 
-	return EXIT_SUCCESS;
+	return result ? EXIT_SUCCESS : EXIT_FAILURE;
 }
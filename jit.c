@@ -0,0 +1,549 @@
+#include "jit.h"
+
+#include "fuse.h"
+#include "x64.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+
+#if defined(__x86_64__)
+
+typedef int64_t (*jit_entry)(int64_t* regs, const void* start);
+
+typedef struct {
+	size_t at;
+	size_t target;
+} jit_fixup;
+
+typedef struct {
+	x64_buffer text;
+	const kyou_program* program;
+	kyou_output* output;
+	void** native;
+
+	size_t* offsets;
+	size_t exit_offset, bad_jump_offset;
+
+	jit_fixup* fixups;
+	size_t fixups_size, fixups_capacity;
+
+	// trace guards, target being the pc to resume interpreting at
+	jit_fixup* exits;
+	size_t exits_size, exits_capacity;
+} jit_state;
+
+// programs see the five elements in callee-saved registers (same as kyouc),
+// the rest of the VM registers stay in memory, addressed off rbp
+static int host_reg(uint8_t reg)
+{
+	return reg <= REG_EARTH ? kyou_reg2x64id(reg) : -1;
+}
+
+static void jit_print_int(int64_t value, kyou_output* out)
+{
+	output_int(out, value);
+}
+
+static void jit_print_string(int64_t value, kyou_output* out)
+{
+	output_string(out, (const char*)value, strlen((const char*)value));
+}
+
+static void jit_print_char(int64_t value, kyou_output* out)
+{
+	output_char(out, (char)value);
+}
+
+static void jit_print_const(int64_t value, kyou_output* out, size_t length)
+{
+	output_string(out, (const char*)value, length);
+}
+
+static void push_fixup(jit_fixup** list, size_t* size, size_t* capacity, size_t at, size_t target)
+{
+	if (*size == *capacity) {
+		*capacity = *capacity ? 2 * *capacity : 64;
+		*list = realloc(*list, sizeof(jit_fixup) * *capacity);
+	}
+	(*list)[(*size)++] = (jit_fixup){ .at = at, .target = target };
+}
+
+static void add_fixup(jit_state* j, size_t at, size_t target)
+{
+	push_fixup(&j->fixups, &j->fixups_size, &j->fixups_capacity, at, target);
+}
+
+static void add_exit(jit_state* j, size_t at, size_t resume)
+{
+	push_fixup(&j->exits, &j->exits_size, &j->exits_capacity, at, resume);
+}
+
+// puts kyou register reg into a host register, loading it into tmp if needed
+static uint8_t read_reg(jit_state* j, uint8_t reg, uint8_t tmp)
+{
+	int host = host_reg(reg);
+	if (host >= 0)
+		return host;
+	emit_load(&j->text, tmp, X64_RBP, 8 * reg);
+	return tmp;
+}
+
+static void write_reg(jit_state* j, uint8_t reg, uint8_t from)
+{
+	int host = host_reg(reg);
+	if (host < 0)
+		emit_store(&j->text, X64_RBP, 8 * reg, from);
+	else if (host != from)
+		emit_move_r2r(&j->text, host, from);
+}
+
+static uint8_t read_source(jit_state* j, const kyou_insn* insn, int immediate, uint8_t tmp)
+{
+	if (immediate) {
+		emit_move_imm2r(&j->text, tmp, insn->imm);
+		return tmp;
+	}
+	return read_reg(j, insn->b, tmp);
+}
+
+// the storage stack lives in VM memory and grows upwards, rcx holds its top
+static void emit_stack_push(jit_state* j, uint8_t value)
+{
+	emit_load(&j->text, X64_RCX, X64_RBP, 8 * REG_STORAGE);
+	emit_store(&j->text, X64_RCX, 0, value);
+	emit_add_imm2r(&j->text, X64_RCX, 8);
+	emit_store(&j->text, X64_RBP, 8 * REG_STORAGE, X64_RCX);
+}
+
+static void emit_stack_pop(jit_state* j, uint8_t to)
+{
+	emit_load(&j->text, X64_RCX, X64_RBP, 8 * REG_STORAGE);
+	emit_sub_imm2r(&j->text, X64_RCX, 8);
+	emit_store(&j->text, X64_RBP, 8 * REG_STORAGE, X64_RCX);
+	emit_load(&j->text, to, X64_RCX, 0);
+}
+
+static void emit_jump_to(jit_state* j, size_t offset)
+{
+	x64_patch_rel32(&j->text, emit_jmp_rel32(&j->text), offset);
+}
+
+// jumps to the pc held in rax through the native entry table
+static void emit_indirect_jump(jit_state* j)
+{
+	emit_cmp_imm2r(&j->text, X64_RAX, j->program->size);
+	x64_patch_rel32(&j->text, emit_jcc_rel32(&j->text, X64_CC_AE), j->bad_jump_offset);
+	emit_move_imm2r(&j->text, X64_RCX, (uint64_t)j->native);
+	emit_load_indexed(&j->text, X64_RAX, X64_RCX, X64_RAX);
+	emit_jmp_r(&j->text, X64_RAX);
+}
+
+// calls helper(rdi, output), the arguments past the second one are up to the caller
+static void emit_helper_call(jit_state* j, const void* helper)
+{
+	emit_move_imm2r(&j->text, X64_RSI, (uint64_t)j->output);
+	emit_move_imm2r(&j->text, X64_RAX, (uint64_t)helper);
+	emit_call_r(&j->text, X64_RAX);
+}
+
+static void emit_prologue(jit_state* j)
+{
+	x64_buffer* b = &j->text;
+
+	emit_push_r(b, X64_RBX);
+	emit_push_r(b, X64_RBP);
+	emit_push_r(b, X64_R12);
+	emit_push_r(b, X64_R13);
+	emit_push_r(b, X64_R14);
+	emit_push_r(b, X64_R15);
+	emit_sub_imm2r(b, X64_RSP, 8); // keeps rsp 16-byte aligned for helper calls
+	emit_move_r2r(b, X64_RBP, X64_RDI);
+	for (uint8_t r = REG_FIRE; r <= REG_EARTH; ++r)
+		emit_load(b, kyou_reg2x64id(r), X64_RBP, 8 * r);
+	emit_jmp_r(b, X64_RSI);
+
+	j->bad_jump_offset = b->size;
+	emit_move_imm2r(b, X64_RAX, (uint64_t)JIT_BAD_JUMP);
+
+	// everything leaves through here with the result in rax
+	j->exit_offset = b->size;
+	for (uint8_t r = REG_FIRE; r <= REG_EARTH; ++r)
+		emit_store(b, X64_RBP, 8 * r, kyou_reg2x64id(r));
+	emit_add_imm2r(b, X64_RSP, 8);
+	emit_pop_r(b, X64_R15);
+	emit_pop_r(b, X64_R14);
+	emit_pop_r(b, X64_R13);
+	emit_pop_r(b, X64_R12);
+	emit_pop_r(b, X64_RBP);
+	emit_pop_r(b, X64_RBX);
+	emit_ret(b);
+}
+
+static void compile_alu(jit_state* j, const kyou_insn* insn, int base, int immediate)
+{
+	uint8_t dest = read_reg(j, insn->a, X64_RAX);
+
+	if (immediate && x64_fits_imm32(insn->imm)) {
+		switch (base) {
+			case OPCODE_ADD_R: emit_add_imm2r(&j->text, dest, insn->imm); break;
+			case OPCODE_SUB_R: emit_sub_imm2r(&j->text, dest, insn->imm); break;
+			case OPCODE_MUL_R: emit_imul_imm2r(&j->text, dest, insn->imm); break;
+		}
+	} else {
+		uint8_t src = read_source(j, insn, immediate, X64_RCX);
+		switch (base) {
+			case OPCODE_ADD_R: emit_add_r2r(&j->text, dest, src); break;
+			case OPCODE_SUB_R: emit_sub_r2r(&j->text, dest, src); break;
+			case OPCODE_MUL_R: emit_imul_r2r(&j->text, dest, src); break;
+		}
+	}
+
+	write_reg(j, insn->a, dest);
+}
+
+static void compile_div(jit_state* j, const kyou_insn* insn, int base, int immediate)
+{
+	uint8_t dest = read_reg(j, insn->a, X64_RAX);
+	if (dest != X64_RAX)
+		emit_move_r2r(&j->text, X64_RAX, dest);
+
+	uint8_t src = read_source(j, insn, immediate, X64_RCX);
+	emit_cqo(&j->text);
+	emit_idiv_r(&j->text, src);
+	write_reg(j, insn->a, base == OPCODE_DIV_R ? X64_RAX : X64_RDX);
+}
+
+// splits an opcode into its register flavour and operand kind
+static int decode_opcode(uint8_t opcode, int* immediate)
+{
+	int op = opcode_unfused(opcode);
+	*immediate = op >= OPCODE_MOVE_I && op < OPCODE_MOVE_I + KYOU_SOURCE_OPCODE_COUNT;
+	return *immediate ? op - KYOU_SOURCE_OPCODE_COUNT : op;
+}
+
+static uint8_t branch_cc(int base)
+{
+	switch (base) {
+		case OPCODE_BRANCH_EQ_R: return X64_CC_E;
+		case OPCODE_BRANCH_GT_R: return X64_CC_G;
+		case OPCODE_BRANCH_LT_R: return X64_CC_L;
+		case OPCODE_BRANCH_GE_R: return X64_CC_GE;
+		default: return X64_CC_LE;
+	}
+}
+
+static int is_branch(int base)
+{
+	return base >= OPCODE_BRANCH_EQ_R && base <= OPCODE_BRANCH_LE_R;
+}
+
+// compares the operands of a conditional branch, leaving the flags set
+static void compile_compare(jit_state* j, const kyou_insn* insn, int immediate)
+{
+	uint8_t a = read_reg(j, insn->a, X64_RAX);
+	if (immediate && x64_fits_imm32(insn->imm))
+		emit_cmp_imm2r(&j->text, a, insn->imm);
+	else
+		emit_cmp_r2r(&j->text, a, read_source(j, insn, immediate, X64_RCX));
+}
+
+// moves the target of a register jump into rax
+static void compile_jump_target(jit_state* j, const kyou_insn* insn)
+{
+	uint8_t value = read_reg(j, insn->a, X64_RAX);
+	if (value != X64_RAX)
+		emit_move_r2r(&j->text, X64_RAX, value);
+}
+
+// instructions that always continue with the next one, returns 0 for anything else
+static int compile_straight(jit_state* j, size_t pc)
+{
+	const kyou_insn* insn = &j->program->code[pc];
+	int immediate;
+	int base = decode_opcode(insn->opcode, &immediate);
+	uint8_t value;
+
+	switch (base) {
+		case OPCODE_MOVE_R:
+			if (immediate && host_reg(insn->a) >= 0)
+				emit_move_imm2r(&j->text, host_reg(insn->a), insn->imm);
+			else
+				write_reg(j, insn->a, read_source(j, insn, immediate, X64_RAX));
+			return 1;
+		case OPCODE_LOAD_R:
+			emit_load(&j->text, X64_RAX, read_source(j, insn, immediate, X64_RCX), 0);
+			write_reg(j, insn->a, X64_RAX);
+			return 1;
+		case OPCODE_STORE_R:
+			value = read_reg(j, insn->a, X64_RAX);
+			emit_store(&j->text, read_source(j, insn, immediate, X64_RCX), 0, value);
+			return 1;
+		case OPCODE_ADD_R:
+		case OPCODE_SUB_R:
+		case OPCODE_MUL_R:
+			compile_alu(j, insn, base, immediate);
+			return 1;
+		case OPCODE_DIV_R:
+		case OPCODE_MOD_R:
+			compile_div(j, insn, base, immediate);
+			return 1;
+		case OPCODE_PRINT_INT_R:
+		case OPCODE_PRINT_STRING_R:
+		case OPCODE_PRINT_CHAR_R:
+			value = read_source(j, insn, immediate, X64_RDI);
+			if (value != X64_RDI)
+				emit_move_r2r(&j->text, X64_RDI, value);
+			emit_helper_call(j, base == OPCODE_PRINT_INT_R ? (const void*)jit_print_int : (base == OPCODE_PRINT_STRING_R ? (const void*)jit_print_string : (const void*)jit_print_char));
+			return 1;
+		case OPCODE_PRINT_CONST:
+			emit_move_imm2r(&j->text, X64_RDI, (uint64_t)PROGRAM_STRING(j->program, insn->imm));
+			emit_move_imm2r(&j->text, X64_RDX, j->program->strings[insn->imm].length);
+			emit_helper_call(j, (const void*)jit_print_const);
+			return 1;
+		case OPCODE_PUSH_R:
+			emit_stack_push(j, read_source(j, insn, immediate, X64_RAX));
+			return 1;
+		case OPCODE_POP:
+			emit_stack_pop(j, X64_RAX);
+			write_reg(j, insn->a, X64_RAX);
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+static void compile_insn(jit_state* j, size_t pc)
+{
+	const kyou_insn* insn = &j->program->code[pc];
+	int immediate;
+	int base = decode_opcode(insn->opcode, &immediate);
+
+	if (is_branch(base)) {
+		compile_compare(j, insn, immediate);
+		add_fixup(j, emit_jcc_rel32(&j->text, branch_cc(base)), insn->target);
+		return;
+	}
+
+	switch (base) {
+		case OPCODE_JUMP:
+			add_fixup(j, emit_jmp_rel32(&j->text), insn->target);
+			break;
+		case OPCODE_JUMP_REG:
+			compile_jump_target(j, insn);
+			emit_indirect_jump(j);
+			break;
+		case OPCODE_CALL:
+			emit_move_imm2r(&j->text, X64_RAX, pc + 1);
+			emit_stack_push(j, X64_RAX);
+			add_fixup(j, emit_jmp_rel32(&j->text), insn->target);
+			break;
+		case OPCODE_CALL_REG:
+			compile_jump_target(j, insn);
+			emit_move_imm2r(&j->text, X64_RDX, pc + 1);
+			emit_stack_push(j, X64_RDX);
+			emit_indirect_jump(j);
+			break;
+		case OPCODE_RETURN:
+			emit_stack_pop(j, X64_RAX);
+			emit_indirect_jump(j);
+			break;
+		case OPCODE_HALT:
+			emit_move_imm2r(&j->text, X64_RAX, (uint64_t)JIT_HALTED);
+			emit_jump_to(j, j->exit_offset);
+			break;
+		default:
+			if (!compile_straight(j, pc)) {
+				// side exit, the interpreter picks up from this very instruction
+				emit_move_imm2r(&j->text, X64_RAX, pc);
+				emit_jump_to(j, j->exit_offset);
+			}
+			break;
+	}
+}
+
+static void jit_state_free(jit_state* j)
+{
+	free(j->offsets);
+	free(j->fixups);
+	free(j->exits);
+	x64_buffer_free(&j->text);
+}
+
+// copies the emitted code into a fresh mapping that is executable but no longer writable
+static jit_result_t jit_finalize(jit_state* j, kyou_jit* jit)
+{
+	void* code = mmap(NULL, j->text.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (code == MAP_FAILED) {
+		fprintf(stderr, "error: could not map memory for the JIT\n");
+		jit_state_free(j);
+		jit_free(jit);
+		return JIT_ERROR;
+	}
+
+	memcpy(code, j->text.data, j->text.size);
+	mprotect(code, j->text.size, PROT_READ | PROT_EXEC);
+
+	jit->code = code;
+	jit->code_size = j->text.size;
+	jit_state_free(j);
+	return JIT_SUCCESS;
+}
+
+jit_result_t jit_compile(const kyou_program* program, kyou_output* output, kyou_jit* jit)
+{
+	jit_state j = { .program = program, .output = output };
+
+	*jit = (kyou_jit){ .size = program->size };
+	jit->native = malloc(sizeof(void*) * program->size);
+	j.native = jit->native;
+	j.offsets = malloc(sizeof(size_t) * program->size);
+
+	emit_prologue(&j);
+	for (size_t pc = 0; pc < program->size; ++pc) {
+		j.offsets[pc] = j.text.size;
+		compile_insn(&j, pc);
+	}
+
+	for (size_t i = 0; i < j.fixups_size; ++i)
+		x64_patch_rel32(&j.text, j.fixups[i].at, j.offsets[j.fixups[i].target]);
+
+	// offsets are gone once the code is finalized
+	size_t* offsets = j.offsets;
+	j.offsets = NULL;
+
+	if (jit_finalize(&j, jit) != JIT_SUCCESS) {
+		free(offsets);
+		return JIT_ERROR;
+	}
+
+	for (size_t pc = 0; pc < program->size; ++pc)
+		jit->native[pc] = (char*)jit->code + offsets[pc];
+	free(offsets);
+	return JIT_SUCCESS;
+}
+
+jit_result_t jit_compile_trace(const kyou_program* program, kyou_output* output, const uint32_t* trace, size_t length, kyou_jit* jit)
+{
+	jit_state j = { .program = program, .output = output };
+
+	*jit = (kyou_jit){ 0 };
+
+	emit_prologue(&j);
+	size_t loop = j.text.size;
+
+	for (size_t i = 0; i < length; ++i) {
+		size_t pc = trace[i];
+		size_t next = i + 1 < length ? trace[i + 1] : trace[0];
+		const kyou_insn* insn = &program->code[pc];
+		int immediate;
+		int base = decode_opcode(insn->opcode, &immediate);
+
+		if (is_branch(base)) {
+			if (insn->target == pc + 1)
+				continue;
+
+			// guard on the direction the branch took while recording
+			int taken = next == insn->target;
+			compile_compare(&j, insn, immediate);
+			add_exit(&j, emit_jcc_rel32(&j.text, taken ? branch_cc(base) ^ 1 : branch_cc(base)), taken ? pc + 1 : insn->target);
+			continue;
+		}
+
+		switch (base) {
+			case OPCODE_JUMP:
+				break;
+			case OPCODE_CALL:
+				emit_move_imm2r(&j.text, X64_RAX, pc + 1);
+				emit_stack_push(&j, X64_RAX);
+				break;
+			case OPCODE_JUMP_REG:
+			case OPCODE_CALL_REG:
+			case OPCODE_RETURN:
+				if (base == OPCODE_RETURN) {
+					emit_stack_pop(&j, X64_RAX);
+				} else {
+					compile_jump_target(&j, insn);
+					if (base == OPCODE_CALL_REG) {
+						emit_move_imm2r(&j.text, X64_RDX, pc + 1);
+						emit_stack_push(&j, X64_RDX);
+					}
+				}
+				// leaving the trace with the actual target in rax as the pc to resume at
+				emit_cmp_imm2r(&j.text, X64_RAX, next);
+				x64_patch_rel32(&j.text, emit_jcc_rel32(&j.text, X64_CC_NE), j.exit_offset);
+				break;
+			case OPCODE_HALT:
+				emit_move_imm2r(&j.text, X64_RAX, (uint64_t)JIT_HALTED);
+				emit_jump_to(&j, j.exit_offset);
+				break;
+			default:
+				if (!compile_straight(&j, pc)) {
+					jit_state_free(&j);
+					return JIT_ERROR;
+				}
+				break;
+		}
+	}
+	emit_jump_to(&j, loop);
+
+	for (size_t i = 0; i < j.exits_size; ++i) {
+		x64_patch_rel32(&j.text, j.exits[i].at, j.text.size);
+		emit_move_imm2r(&j.text, X64_RAX, j.exits[i].target);
+		emit_jump_to(&j, j.exit_offset);
+	}
+
+	if (jit_finalize(&j, jit) != JIT_SUCCESS)
+		return JIT_ERROR;
+	jit->entry = (char*)jit->code + loop;
+	return JIT_SUCCESS;
+}
+
+int64_t jit_run(const kyou_jit* jit, int64_t* regs, size_t pc)
+{
+	jit_entry entry = (jit_entry)jit->code;
+	return entry(regs, jit->native[pc]);
+}
+
+int64_t jit_run_trace(const kyou_jit* trace, int64_t* regs)
+{
+	jit_entry entry = (jit_entry)trace->code;
+	return entry(regs, trace->entry);
+}
+
+#else
+
+jit_result_t jit_compile(const kyou_program* program, kyou_output* output, kyou_jit* jit)
+{
+	*jit = (kyou_jit){ 0 };
+	fprintf(stderr, "error: the JIT only supports x86-64\n");
+	return JIT_ERROR;
+}
+
+jit_result_t jit_compile_trace(const kyou_program* program, kyou_output* output, const uint32_t* trace, size_t length, kyou_jit* jit)
+{
+	*jit = (kyou_jit){ 0 };
+	return JIT_ERROR;
+}
+
+int64_t jit_run(const kyou_jit* jit, int64_t* regs, size_t pc)
+{
+	return pc;
+}
+
+int64_t jit_run_trace(const kyou_jit* trace, int64_t* regs)
+{
+	return JIT_BAD_JUMP;
+}
+
+#endif
+
+void jit_free(kyou_jit* jit)
+{
+	if (jit->code)
+		munmap(jit->code, jit->code_size);
+	free(jit->native);
+	*jit = (kyou_jit){ 0 };
+}
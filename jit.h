@@ -0,0 +1,34 @@
+#pragma once
+
+#include "bytecode.h"
+#include "output.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// jit_run results besides a pc to resume interpreting at
+#define JIT_HALTED (-1)
+#define JIT_BAD_JUMP (-2)
+
+typedef struct {
+	void* code;
+	size_t code_size;
+	void** native; // entry point of every pc, used by returns and register jumps
+	size_t size;
+	void* entry;   // start of the loop for compiled traces
+} kyou_jit;
+
+typedef enum { JIT_SUCCESS, JIT_ERROR } jit_result_t;
+
+// compiles the whole program into native x86-64 code; instructions the JIT
+// can't handle become exits that hand their pc back to the interpreter
+jit_result_t jit_compile(const kyou_program* program, kyou_output* output, kyou_jit* jit);
+
+// compiles a recorded loop, trace being the pcs executed from the loop head
+// up to the jump back to it; leaving the recorded path exits to the interpreter
+jit_result_t jit_compile_trace(const kyou_program* program, kyou_output* output, const uint32_t* trace, size_t length, kyou_jit* jit);
+
+// runs from pc with the VM registers in regs, which are written back on exit
+int64_t jit_run(const kyou_jit* jit, int64_t* regs, size_t pc);
+int64_t jit_run_trace(const kyou_jit* trace, int64_t* regs);
+void jit_free(kyou_jit* jit);
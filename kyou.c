@@ -0,0 +1,105 @@
+#include "kyou.h"
+
+#include "ast.h"
+#include "fuse.h"
+#include "interpret.h"
+#include "link.h"
+#include "optimize.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+kyou_program* kyou_load(const char* source, size_t size, unsigned flags)
+{
+	AST ast;
+	if (build_ast(&ast, (const unsigned char*)source, size) != AST_SUCCESS)
+		return NULL;
+
+	kyou_program* program = malloc(sizeof(kyou_program));
+	if (!program || link_ast(&ast) != LINK_SUCCESS) {
+		free(program);
+		ast_free(&ast);
+		return NULL;
+	}
+
+	if (flags & KYOU_LOAD_OPTIMIZE)
+		optimize_ast(&ast, INLINE_DEFAULT_THRESHOLD, ALL_REGISTERS);
+	if (lower_ast(&ast, program) != LOWER_SUCCESS) {
+		free(program);
+		ast_free(&ast);
+		return NULL;
+	}
+	ast_free(&ast);
+
+	if (flags & KYOU_LOAD_FUSE)
+		fuse_program(program);
+	return program;
+}
+
+void kyou_unload(kyou_program* program)
+{
+	program_free(program);
+	free(program);
+}
+
+kyou_vm* kyou_vm_create(const kyou_program* program, kyou_sink sink, void* context, size_t stack_size)
+{
+	interpret_options options = { .stack_size = stack_size };
+
+	kyou_vm* vm = malloc(sizeof(kyou_vm));
+	if (!vm) {
+		fprintf(stderr, "error: failed to allocate VM\n");
+		return NULL;
+	}
+	if (!vm_init(vm, program, sink, context, &options)) {
+		free(vm);
+		return NULL;
+	}
+	return vm;
+}
+
+void kyou_vm_destroy(kyou_vm* vm)
+{
+	vm_destroy(vm);
+	free(vm);
+}
+
+void kyou_vm_reset(kyou_vm* vm)
+{
+	vm_reset(vm);
+}
+
+kyou_status kyou_run(kyou_vm* vm, uint64_t budget)
+{
+	if (budget == 0) {
+		interpret_options options = { 0 };
+		return (kyou_status)vm_run(vm, &options);
+	}
+	return (kyou_status)vm_run_budget(vm, budget);
+}
+
+kyou_status kyou_step(kyou_vm* vm)
+{
+	return (kyou_status)vm_run_budget(vm, 1);
+}
+
+kyou_status kyou_run_fuel(kyou_vm* vm, uint64_t fuel)
+{
+	return (kyou_status)vm_run_fuel(vm, fuel);
+}
+
+size_t kyou_pc(const kyou_vm* vm)
+{
+	return vm->pc;
+}
+
+int64_t kyou_get_register(const kyou_vm* vm, int reg)
+{
+	return reg >= 0 && reg < KYOU_REGISTER_COUNT ? vm->regs[reg] : 0;
+}
+
+void kyou_set_register(kyou_vm* vm, int reg, int64_t value)
+{
+	if (reg >= 0 && reg < KYOU_REGISTER_COUNT)
+		vm->regs[reg] = value;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+// embedding API of libkyou: load a program once, then run it on any number
+// of VMs, each one used by a single thread at a time. Diagnostics go to stderr.
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct kyou_program kyou_program;
+typedef struct kyou_vm kyou_vm;
+
+// receives program output, a chunk of whole lines at a time
+typedef void (*kyou_sink)(void* context, const char* data, size_t size);
+
+typedef enum { KYOU_ERROR, KYOU_HALTED, KYOU_PAUSED } kyou_status;
+
+// register numbers, in the order of kyou_register_t
+enum { KYOU_FIRE, KYOU_WATER, KYOU_TREE, KYOU_METAL, KYOU_EARTH, KYOU_STORAGE, KYOU_STORAGE_BASE };
+
+// flags of kyou_load. Without them every instruction is one node of the
+// source, as kyou_pc and kyou_step expect. KYOU_LOAD_OPTIMIZE runs the AST
+// passes the kyou tool runs unless --no-optimize, KYOU_LOAD_FUSE builds
+// superinstructions; both only keep the registers the program halts with
+enum { KYOU_LOAD_OPTIMIZE = 1, KYOU_LOAD_FUSE = 2 };
+
+// tokenizes, parses, links and lowers source, NULL on errors
+kyou_program* kyou_load(const char* source, size_t size, unsigned flags);
+void kyou_unload(kyou_program* program);
+
+// stack_size is in bytes, the default of the kyou tool when 0
+kyou_vm* kyou_vm_create(const kyou_program* program, kyou_sink sink, void* context, size_t stack_size);
+void kyou_vm_destroy(kyou_vm* vm);
+// starts the program over with cleared registers and an empty stack
+void kyou_vm_reset(kyou_vm* vm);
+
+// runs until the program halts, fails or budget instructions ran,
+// budget 0 means no limit; output is flushed into the sink before returning.
+// Overrunning the storage stack fails with KYOU_ERROR, after which the VM
+// needs a kyou_vm_reset before it runs again. Other SIGSEGVs go on to the
+// handler installed before the first run; one installed later replaces ours
+kyou_status kyou_run(kyou_vm* vm, uint64_t budget);
+kyou_status kyou_step(kyou_vm* vm);
+// like kyou_run, but fuel is only checked at backward jumps and calls, so the
+// program yields after roughly fuel instructions at nearly full speed
+kyou_status kyou_run_fuel(kyou_vm* vm, uint64_t fuel);
+
+// index of the next instruction to run
+size_t kyou_pc(const kyou_vm* vm);
+int64_t kyou_get_register(const kyou_vm* vm, int reg);
+void kyou_set_register(kyou_vm* vm, int reg, int64_t value);
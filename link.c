@@ -0,0 +1,106 @@
+#include "link.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// labels[symbol] is the index of the LABEL node defining it + 1, 0 for none
+static int link_address(const size_t* labels, AST* ast, AST_address* addr)
+{
+	if (addr->type != ADDRESS_LABEL)
+		return 1;
+
+	if (labels[addr->as_label] == 0) {
+		fprintf(stderr, "error: no such label %s\n", symbol_name(&ast->symbols, addr->as_label));
+		return 0;
+	}
+
+	addr->type = ADDRESS_NODE;
+	addr->as_node = labels[addr->as_label] - 1;
+	return 1;
+}
+
+static int link_source(const size_t* labels, AST* ast, AST_source* src)
+{
+	if (src->type == SOURCE_MEM)
+		return link_address(labels, ast, &src->as_mem);
+
+	if (src->type != SOURCE_LABEL)
+		return 1;
+
+	if (labels[src->as_label] == 0) {
+		fprintf(stderr, "error: no such label %s\n", symbol_name(&ast->symbols, src->as_label));
+		return 0;
+	}
+
+	src->type = SOURCE_NODE;
+	src->as_node = labels[src->as_label] - 1;
+	return 1;
+}
+
+static int link_destination(const size_t* labels, AST* ast, AST_destination* dest)
+{
+	if (dest->type == DESTINATION_MEM)
+		return link_address(labels, ast, &dest->as_mem);
+	return 1;
+}
+
+link_result_t link_ast(AST* ast)
+{
+	size_t* labels = calloc(ast->symbols.size + 1, sizeof(size_t));
+	link_result_t result = LINK_SUCCESS;
+
+	if (labels == NULL) {
+		fprintf(stderr, "error: out of memory for labels\n");
+		return LINK_ERROR;
+	}
+
+	for (size_t i = 0; i < ast->size; ++i) {
+		if (ast->nodes[i].type != LABEL)
+			continue;
+
+		uint32_t symbol = ast->nodes[i].symbol;
+		if (labels[symbol] == 0) {
+			labels[symbol] = i + 1;
+		} else {
+			fprintf(stderr, "error: same label %s declared twice\n", symbol_name(&ast->symbols, symbol));
+			result = LINK_ERROR;
+		}
+	}
+
+	// keep going after the first error so that every bad label is reported at once
+	for (size_t i = 0; i < ast->size; ++i) {
+		AST_node* node = &ast->nodes[i];
+		int ok = 1;
+
+		switch (node->type) {
+			case MOVE_STATEMENT:
+				ok = link_source(labels, ast, &node->move_src) & link_destination(labels, ast, &node->move_dest);
+				break;
+			case OPERATOR_STATEMENT:
+				ok = link_source(labels, ast, &node->op_src);
+				break;
+			case BRANCH_STATEMENT:
+				ok = link_address(labels, ast, &node->branch_addr);
+				if (node->branch_type != BRANCH_ALWAYS)
+					ok &= link_source(labels, ast, &node->branch_a) & link_source(labels, ast, &node->branch_b);
+				break;
+			case PUSH_STATEMENT:
+				ok = link_source(labels, ast, &node->push_from);
+				break;
+			case POP_STATEMENT:
+				ok = link_destination(labels, ast, &node->pop_to);
+				break;
+			case CALL_STATEMENT:
+				ok = link_address(labels, ast, &node->call_to);
+				break;
+			default:
+				break;
+		}
+
+		if (!ok)
+			result = LINK_ERROR;
+	}
+
+	free(labels);
+	return result;
+}
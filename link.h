@@ -0,0 +1,9 @@
+#pragma once
+
+#include "ast.h"
+
+typedef enum { LINK_SUCCESS, LINK_ERROR } link_result_t;
+
+// resolves every label operand in the AST into an index of its LABEL node,
+// so nothing has to look labels up by name while the program runs
+link_result_t link_ast(AST* ast);
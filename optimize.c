@@ -0,0 +1,500 @@
+#include "optimize.h"
+
+#include "cfg.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// constants known for each register at the current node; the storage
+// registers are never tracked, the stack instructions change them implicitly
+typedef struct {
+	int known[REG_STORAGE];
+	int64_t value[REG_STORAGE];
+} register_values;
+
+static int is_tracked(kyou_register_t reg)
+{
+	return reg < REG_STORAGE;
+}
+
+static void forget(register_values* v, kyou_register_t reg)
+{
+	if (is_tracked(reg))
+		v->known[reg] = 0;
+}
+
+static void forget_all(register_values* v)
+{
+	for (int i = 0; i < REG_STORAGE; ++i)
+		v->known[i] = 0;
+}
+
+static void learn(register_values* v, kyou_register_t reg, int64_t value)
+{
+	if (is_tracked(reg)) {
+		v->known[reg] = 1;
+		v->value[reg] = value;
+	}
+}
+
+// turns a register source holding a known constant into an immediate
+static int propagate(const register_values* v, AST_source* src)
+{
+	if (src->type != SOURCE_REGISTER || !is_tracked(src->as_reg) || !v->known[src->as_reg])
+		return 0;
+
+	src->as_immediate = v->value[src->as_reg];
+	src->type = SOURCE_IMMEDIATE;
+	return 1;
+}
+
+// evaluates like the interpreter does, except that division faults are left to run time
+static int evaluate(int op, int64_t a, int64_t b, int64_t* result)
+{
+	switch (op) {
+		case OP_ADD: *result = (int64_t)((uint64_t)a + (uint64_t)b); return 1;
+		case OP_SUB: *result = (int64_t)((uint64_t)a - (uint64_t)b); return 1;
+		case OP_MUL: *result = (int64_t)((uint64_t)a * (uint64_t)b); return 1;
+		case OP_DIV:
+		case OP_MOD:
+			if (b == 0 || (a == INT64_MIN && b == -1))
+				return 0;
+			*result = op == OP_DIV ? a / b : a % b;
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+static int fold_op(register_values* v, AST_node* node)
+{
+	int changed = propagate(v, &node->op_src);
+	kyou_register_t reg = node->op_reg;
+	int64_t result;
+
+	if (is_tracked(reg) && v->known[reg] && node->op_src.type == SOURCE_IMMEDIATE
+		&& evaluate(node->op_type, v->value[reg], node->op_src.as_immediate, &result)) {
+		*node = (AST_node){
+			.type = MOVE_STATEMENT,
+			.move_src = { .type = SOURCE_IMMEDIATE, .power = POWER_WINTER, .as_immediate = result },
+			.move_dest = { .type = DESTINATION_REGISTER, .power = POWER_WINTER, .as_reg = reg },
+			.line = node->line,
+			.col = node->col
+		};
+		learn(v, reg, result);
+		return 1;
+	}
+
+	forget(v, reg);
+	return changed;
+}
+
+static int fold_move(register_values* v, AST_node* node)
+{
+	int changed = propagate(v, &node->move_src);
+
+	if (node->move_dest.type == DESTINATION_REGISTER) {
+		if (node->move_src.type == SOURCE_IMMEDIATE)
+			learn(v, node->move_dest.as_reg, node->move_src.as_immediate);
+		else
+			forget(v, node->move_dest.as_reg);
+	}
+	return changed;
+}
+
+size_t fold_constants(AST* ast)
+{
+	register_values v;
+	size_t changed = 0;
+
+	forget_all(&v);
+	for (size_t i = 0; i < ast->size; ++i) {
+		AST_node* node = &ast->nodes[i];
+
+		switch (node->type) {
+			case MOVE_STATEMENT:
+				changed += fold_move(&v, node);
+				break;
+			case OPERATOR_STATEMENT:
+				changed += fold_op(&v, node);
+				break;
+			case PUSH_STATEMENT:
+				changed += propagate(&v, &node->push_from);
+				break;
+			case POP_STATEMENT:
+				if (node->pop_to.type == DESTINATION_REGISTER)
+					forget(&v, node->pop_to.as_reg);
+				break;
+			case BRANCH_STATEMENT:
+				if (node->branch_type != BRANCH_ALWAYS) {
+					changed += propagate(&v, &node->branch_a);
+					changed += propagate(&v, &node->branch_b);
+				}
+				forget_all(&v);
+				break;
+			case TEMP_STR_PRINT:
+				break;
+			default:
+				// labels start a block, calls and returns leave it
+				forget_all(&v);
+				break;
+		}
+	}
+	return changed;
+}
+
+
+static unsigned address_uses(const AST_address* addr)
+{
+	return addr->type == ADDRESS_REGISTER ? REG_BIT(addr->as_reg) : 0;
+}
+
+static unsigned source_uses(const AST_source* src)
+{
+	switch (src->type) {
+		case SOURCE_REGISTER: return REG_BIT(src->as_reg);
+		case SOURCE_MEM: return address_uses(&src->as_mem);
+		default: return 0;
+	}
+}
+
+static unsigned destination_uses(const AST_destination* dest)
+{
+	return dest->type == DESTINATION_MEM ? address_uses(&dest->as_mem) : 0;
+}
+
+// registers a node reads and writes
+static void node_effects(const AST_node* node, unsigned* use, unsigned* def)
+{
+	*use = *def = 0;
+
+	switch (node->type) {
+		case MOVE_STATEMENT:
+			*use = source_uses(&node->move_src) | destination_uses(&node->move_dest);
+			if (node->move_dest.type == DESTINATION_REGISTER)
+				*def = REG_BIT(node->move_dest.as_reg);
+			break;
+		case OPERATOR_STATEMENT:
+			*use = REG_BIT(node->op_reg) | source_uses(&node->op_src);
+			*def = REG_BIT(node->op_reg);
+			break;
+		case BRANCH_STATEMENT:
+			*use = address_uses(&node->branch_addr);
+			if (node->branch_type != BRANCH_ALWAYS)
+				*use |= source_uses(&node->branch_a) | source_uses(&node->branch_b);
+			break;
+		case PUSH_STATEMENT:
+			*use = source_uses(&node->push_from) | REG_BIT(REG_STORAGE);
+			*def = REG_BIT(REG_STORAGE);
+			break;
+		case POP_STATEMENT:
+			*use = destination_uses(&node->pop_to) | REG_BIT(REG_STORAGE);
+			*def = REG_BIT(REG_STORAGE);
+			if (node->pop_to.type == DESTINATION_REGISTER)
+				*def |= REG_BIT(node->pop_to.as_reg);
+			break;
+		case CALL_STATEMENT:
+			*use = address_uses(&node->call_to) | REG_BIT(REG_STORAGE);
+			*def = REG_BIT(REG_STORAGE);
+			break;
+		case RETURN_STATEMENT:
+			*use = *def = REG_BIT(REG_STORAGE);
+			break;
+		default:
+			break;
+	}
+}
+
+// registers, immediates and label addresses; memory may fault and 月 reads input
+static int is_plain_source(const AST_source* src)
+{
+	return src->type == SOURCE_REGISTER || src->type == SOURCE_IMMEDIATE || src->type == SOURCE_NODE;
+}
+
+// a write into a general register that has no other effect and cannot fault
+static int is_removable_store(const AST_node* node)
+{
+	switch (node->type) {
+		case MOVE_STATEMENT:
+			return node->move_dest.type == DESTINATION_REGISTER && is_tracked(node->move_dest.as_reg)
+				&& is_plain_source(&node->move_src);
+		case OPERATOR_STATEMENT:
+			if (!is_tracked(node->op_reg) || !is_plain_source(&node->op_src))
+				return 0;
+			if (node->op_type == OP_DIV || node->op_type == OP_MOD)
+				return node->op_src.type == SOURCE_IMMEDIATE && node->op_src.as_immediate != 0 && node->op_src.as_immediate != -1;
+			return node->op_type == OP_ADD || node->op_type == OP_SUB || node->op_type == OP_MUL;
+		default:
+			return 0;
+	}
+}
+
+// registers live into a block, skipping removed nodes; with dead given, stores
+// nobody reads are marked removed on the way and counted in dead
+static unsigned block_live_in(const AST* ast, const cfg_block* block, unsigned live, char* removed, size_t* dead)
+{
+	for (size_t i = block->end; i-- > block->begin;) {
+		const AST_node* node = &ast->nodes[i];
+		unsigned use, def;
+
+		if (removed[i])
+			continue;
+		node_effects(node, &use, &def);
+		if (dead && is_removable_store(node) && !(live & def)) {
+			removed[i] = 1;
+			++*dead;
+			continue;
+		}
+		live = (live & ~def) | use;
+	}
+	return live;
+}
+
+static void remap_address(AST_address* addr, const size_t* index_of)
+{
+	if (addr->type == ADDRESS_NODE)
+		addr->as_node = index_of[addr->as_node];
+}
+
+static void remap_source(AST_source* src, const size_t* index_of)
+{
+	if (src->type == SOURCE_NODE)
+		src->as_node = index_of[src->as_node];
+}
+
+// drops the removed nodes, renumbering the linked addresses of the others
+static void remap_node(AST_node* node, const size_t* index_of)
+{
+	switch (node->type) {
+		case MOVE_STATEMENT: remap_source(&node->move_src, index_of); break;
+		case OPERATOR_STATEMENT: remap_source(&node->op_src, index_of); break;
+		case PUSH_STATEMENT: remap_source(&node->push_from, index_of); break;
+		case CALL_STATEMENT: remap_address(&node->call_to, index_of); break;
+		case BRANCH_STATEMENT:
+			remap_address(&node->branch_addr, index_of);
+			if (node->branch_type != BRANCH_ALWAYS) {
+				remap_source(&node->branch_a, index_of);
+				remap_source(&node->branch_b, index_of);
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+static void compact(AST* ast, const char* removed)
+{
+	size_t* index_of = malloc(sizeof(size_t) * ast->size);
+	size_t size = 0;
+
+	for (size_t i = 0; i < ast->size; ++i) {
+		index_of[i] = size;
+		if (!removed[i])
+			ast->nodes[size++] = ast->nodes[i];
+	}
+	ast->size = size;
+
+	for (size_t i = 0; i < ast->size; ++i)
+		remap_node(&ast->nodes[i], index_of);
+	free(index_of);
+}
+
+size_t remove_dead_code(AST* ast, unsigned live_at_exit)
+{
+	cfg g;
+	cfg_build(&g, ast);
+
+	char* removed = calloc(ast->size ? ast->size : 1, 1);
+	size_t count = 0;
+
+	for (size_t b = 0; b < g.size; ++b) {
+		if (g.blocks[b].reachable)
+			continue;
+		for (size_t i = g.blocks[b].begin; i < g.blocks[b].end; ++i)
+			removed[i] = 1;
+		count += g.blocks[b].end - g.blocks[b].begin;
+	}
+
+	// branches decided already go with the edges the graph left out of them:
+	// one never taken could name a label removed above, so it goes too
+	for (size_t b = 0; b < g.size; ++b) {
+		AST_node* last = &ast->nodes[g.blocks[b].end - 1];
+		int taken;
+
+		if (!g.blocks[b].reachable || last->type != BRANCH_STATEMENT || last->branch_type == BRANCH_ALWAYS
+			|| !cfg_branch_taken(last, &taken))
+			continue;
+		if (taken) {
+			last->branch_type = BRANCH_ALWAYS;
+		} else {
+			removed[g.blocks[b].end - 1] = 1;
+			++count;
+		}
+	}
+
+	// live registers at block ends, to a fixed point backwards over the graph;
+	// returns and register jumps may go anywhere, so everything is live there,
+	// and live_at_exit is live where the program runs off its end.
+	// removing stores removes their uses too, so repeat until nothing changes
+	unsigned* live_out = malloc(sizeof(unsigned) * (g.size ? g.size : 1));
+	unsigned* live_in = malloc(sizeof(unsigned) * (g.size ? g.size : 1));
+	size_t removed_stores;
+	do {
+		for (size_t b = 0; b < g.size; ++b)
+			live_out[b] = live_in[b] = 0;
+
+		int changed;
+		do {
+			changed = 0;
+			for (size_t b = g.size; b-- > 0;) {
+				const cfg_block* block = &g.blocks[b];
+				if (!block->reachable)
+					continue;
+
+				unsigned out = block->exits ? ALL_REGISTERS : 0;
+				if (block->halts)
+					out |= live_at_exit;
+				for (int s = 0; s < block->succ_size; ++s)
+					out |= live_in[block->succ[s]];
+				unsigned in = block_live_in(ast, block, out, removed, NULL);
+				if (out != live_out[b] || in != live_in[b]) {
+					live_out[b] = out;
+					live_in[b] = in;
+					changed = 1;
+				}
+			}
+		} while (changed);
+
+		removed_stores = 0;
+		for (size_t b = 0; b < g.size; ++b) {
+			if (g.blocks[b].reachable)
+				block_live_in(ast, &g.blocks[b], live_out[b], removed, &removed_stores);
+		}
+		count += removed_stores;
+	} while (removed_stores);
+
+	if (count)
+		compact(ast, removed);
+
+	free(live_out);
+	free(live_in);
+	free(removed);
+	cfg_free(&g);
+	return count;
+}
+
+#define STORAGE_REGISTERS (REG_BIT(REG_STORAGE) | REG_BIT(REG_STORAGE_BASE))
+
+// number of nodes between label and its 帰 when it can be inlined, 0 otherwise
+static size_t leaf_body_size(const AST* ast, size_t label, size_t threshold)
+{
+	int depth = 0;
+
+	for (size_t i = label + 1; i < ast->size && i <= label + threshold + 1; ++i) {
+		const AST_node* node = &ast->nodes[i];
+		unsigned use, def;
+
+		node_effects(node, &use, &def);
+		switch (node->type) {
+			case RETURN_STATEMENT:
+				return depth == 0 ? i - label - 1 : 0;
+			case PUSH_STATEMENT:
+				++depth;
+				use = source_uses(&node->push_from);
+				def = 0;
+				break;
+			case POP_STATEMENT:
+				if (--depth < 0)
+					return 0;
+				use = destination_uses(&node->pop_to);
+				def &= ~REG_BIT(REG_STORAGE);
+				break;
+			case MOVE_STATEMENT:
+			case OPERATOR_STATEMENT:
+			case TEMP_STR_PRINT:
+				break;
+			default:
+				return 0;
+		}
+		if ((use | def) & STORAGE_REGISTERS)
+			return 0;
+	}
+	return 0;
+}
+
+size_t inline_calls(AST* ast, size_t threshold)
+{
+	if (threshold == 0 || ast->size == 0)
+		return 0;
+
+	// inlinable body size of every label, calls reach labels only
+	size_t* body_of = calloc(ast->size, sizeof(size_t));
+	size_t grown = 0, count = 0;
+	for (size_t i = 0; i < ast->size; ++i) {
+		if (ast->nodes[i].type == LABEL)
+			body_of[i] = leaf_body_size(ast, i, threshold);
+	}
+	for (size_t i = 0; i < ast->size; ++i) {
+		const AST_node* node = &ast->nodes[i];
+		if (node->type == CALL_STATEMENT && node->call_to.type == ADDRESS_NODE && body_of[node->call_to.as_node]) {
+			grown += body_of[node->call_to.as_node] - 1;
+			++count;
+		}
+	}
+	if (count == 0) {
+		free(body_of);
+		return 0;
+	}
+
+	// copies keep the old indices in their addresses until the remap below
+	AST_node* nodes = malloc(sizeof(AST_node) * (ast->size + grown));
+	size_t* index_of = malloc(sizeof(size_t) * ast->size);
+	size_t size = 0;
+	for (size_t i = 0; i < ast->size; ++i) {
+		const AST_node* node = &ast->nodes[i];
+		index_of[i] = size;
+		if (node->type == CALL_STATEMENT && node->call_to.type == ADDRESS_NODE && body_of[node->call_to.as_node]) {
+			size_t label = node->call_to.as_node;
+			for (size_t j = 0; j < body_of[label]; ++j)
+				nodes[size++] = ast->nodes[label + 1 + j];
+		} else {
+			nodes[size++] = *node;
+		}
+	}
+	for (size_t i = 0; i < size; ++i)
+		remap_node(&nodes[i], index_of);
+
+	free(ast->nodes);
+	ast->nodes = nodes;
+	ast->size = size;
+	free(index_of);
+	free(body_of);
+	return count;
+}
+
+size_t convert_tail_calls(AST* ast)
+{
+	size_t count = 0;
+
+	for (size_t i = 0; i + 1 < ast->size; ++i) {
+		AST_node* node = &ast->nodes[i];
+		if (node->type != CALL_STATEMENT || ast->nodes[i + 1].type != RETURN_STATEMENT)
+			continue;
+
+		// the 帰 behind it is unreachable now and goes with remove_dead_code
+		AST_address to = node->call_to;
+		*node = (AST_node){ .type = BRANCH_STATEMENT, .branch_type = BRANCH_ALWAYS, .branch_addr = to, .line = node->line, .col = node->col };
+		++count;
+	}
+	return count;
+}
+
+void optimize_ast(AST* ast, size_t inline_threshold, unsigned live_at_exit)
+{
+	fold_constants(ast);
+	// constants flow into the inlined bodies on the second round
+	if (inline_calls(ast, inline_threshold))
+		fold_constants(ast);
+	convert_tail_calls(ast);
+	remove_dead_code(ast, live_at_exit);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "ast.h"
+
+// passes over a linked AST, run before lowering or compiling it
+
+#define REG_BIT(reg) (1u << (reg))
+#define ALL_REGISTERS (REG_BIT(REG_STORAGE_BASE + 1) - 1)
+
+// tracks registers holding known constants within basic blocks, which end at
+// labels, branches, calls and returns; operators on constants become moves
+// and register sources holding constants become immediates.
+// returns the number of rewritten nodes
+size_t fold_constants(AST* ast);
+
+// removes nodes no path from the start reaches, see cfg.h, branches between
+// immediates that are never taken, and moves and operators into registers
+// that are written again before anything reads them; branches between
+// immediates that are always taken become plain jumps.
+// live_at_exit holds the REG_BITs still read once the program has ended: 0
+// when nothing looks at them afterwards, ALL_REGISTERS for an embedder.
+// returns the number of removed nodes
+size_t remove_dead_code(AST* ast, unsigned live_at_exit);
+
+// copies the body of small leaf labels over the calls to them: bodies of at
+// most threshold straight nodes up to a 帰, that keep their pushes and pops
+// balanced and leave the storage registers alone.
+// returns the number of inlined calls
+size_t inline_calls(AST* ast, size_t threshold);
+
+// turns a 呼 right before a 帰 into a jump, so the callee returns straight to
+// our caller. Like inlining this assumes labels reached by 呼 do not look at
+// the return address under their own pushes.
+// returns the number of converted calls
+size_t convert_tail_calls(AST* ast);
+
+#define INLINE_DEFAULT_THRESHOLD 8
+
+// every pass above, inlining leaf labels of up to inline_threshold nodes
+void optimize_ast(AST* ast, size_t inline_threshold, unsigned live_at_exit);
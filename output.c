@@ -0,0 +1,111 @@
+#include "output.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char digit_pairs[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+void output_init(kyou_output* out, output_sink sink, void* context, size_t flush_lines)
+{
+	out->sink = sink;
+	out->context = context;
+	out->flush_lines = flush_lines;
+	out->lines = 0;
+	out->size = 0;
+}
+
+void output_fd_sink(void* context, const char* data, size_t size)
+{
+	int fd = (int)(intptr_t)context;
+
+	while (size > 0) {
+		ssize_t written = write(fd, data, size);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+		data += written;
+		size -= written;
+	}
+}
+
+void output_flush(kyou_output* out)
+{
+	if (out->size)
+		out->sink(out->context, out->data, out->size);
+	out->size = 0;
+	out->lines = 0;
+}
+
+static void end_line(kyou_output* out)
+{
+	out->data[out->size++] = '\n';
+	if (out->flush_lines && ++out->lines >= out->flush_lines)
+		output_flush(out);
+}
+
+// a line is at most OUTPUT_BUFFER_SIZE bytes, longer strings go around the buffer
+static void reserve(kyou_output* out, size_t size)
+{
+	if (out->size + size > OUTPUT_BUFFER_SIZE)
+		output_flush(out);
+}
+
+void output_int(kyou_output* out, int64_t value)
+{
+	char digits[20];
+	char* p = digits + sizeof(digits);
+	uint64_t u = value < 0 ? -(uint64_t)value : (uint64_t)value;
+
+	while (u >= 100) {
+		p -= 2;
+		memcpy(p, &digit_pairs[(u % 100) * 2], 2);
+		u /= 100;
+	}
+	if (u >= 10) {
+		p -= 2;
+		memcpy(p, &digit_pairs[u * 2], 2);
+	} else {
+		*--p = '0' + u;
+	}
+
+	size_t length = digits + sizeof(digits) - p;
+	reserve(out, length + 2);
+	if (value < 0)
+		out->data[out->size++] = '-';
+	memcpy(out->data + out->size, p, length);
+	out->size += length;
+	end_line(out);
+}
+
+void output_string(kyou_output* out, const char* str, size_t length)
+{
+	if (length + 1 > OUTPUT_BUFFER_SIZE) {
+		output_flush(out);
+		out->sink(out->context, str, length);
+	} else {
+		reserve(out, length + 1);
+		memcpy(out->data + out->size, str, length);
+		out->size += length;
+	}
+	end_line(out);
+}
+
+void output_char(kyou_output* out, char ch)
+{
+	reserve(out, 2);
+	out->data[out->size++] = ch;
+	end_line(out);
+}
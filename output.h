@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+
+// receives every flushed chunk of output
+typedef void (*output_sink)(void* context, const char* data, size_t size);
+
+// buffered writer behind 日: every value written becomes one line, the
+// buffer goes to the sink in one call when full, every flush_lines lines and at exit
+typedef struct {
+	output_sink sink;
+	void* context;
+	size_t flush_lines; // 0 flushes only when full, 1 is line buffering
+	size_t lines;
+	size_t size;
+	char data[OUTPUT_BUFFER_SIZE];
+} kyou_output;
+
+void output_init(kyou_output* out, output_sink sink, void* context, size_t flush_lines);
+// sink writing to a file descriptor, pass FD_CONTEXT(fd) as its context
+void output_fd_sink(void* context, const char* data, size_t size);
+#define FD_CONTEXT(fd) ((void*)(intptr_t)(fd))
+void output_flush(kyou_output* out);
+
+void output_int(kyou_output* out, int64_t value);
+void output_string(kyou_output* out, const char* str, size_t length);
+void output_char(kyou_output* out, char ch);
@@ -0,0 +1,157 @@
+#include "profile.h"
+
+#include "fuse.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+static uint64_t now_nanoseconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void push_frame(profiler* prof, size_t label)
+{
+	if (prof->frames_size == prof->frames_capacity) {
+		prof->frames_capacity = prof->frames_capacity ? 2 * prof->frames_capacity : 64;
+		prof->frames = realloc(prof->frames, sizeof(profile_frame) * prof->frames_capacity);
+	}
+	prof->frames[prof->frames_size++] = (profile_frame){ .label = label, .entered = now_nanoseconds() };
+	prof->labels[label].calls++;
+	prof->labels[label].active++;
+}
+
+static void pop_frame(profiler* prof)
+{
+	profile_frame* frame = &prof->frames[--prof->frames_size];
+	label_profile* label = &prof->labels[frame->label];
+	uint64_t elapsed = now_nanoseconds() - frame->entered;
+
+	label->exclusive += elapsed - frame->children;
+	// recursion would count the time of the inner activations twice
+	if (--label->active == 0)
+		label->inclusive += elapsed;
+	if (prof->frames_size)
+		prof->frames[prof->frames_size - 1].children += elapsed;
+}
+
+void profiler_init(profiler* prof, const kyou_program* program)
+{
+	*prof = (profiler){
+		.program = program,
+		.counts = calloc(program->size, sizeof(uint64_t)),
+		.labels = calloc(program->labels_size + 2, sizeof(label_profile)),
+		.label_at = calloc(program->size + 1, sizeof(uint32_t))
+	};
+
+	// several labels on one pc all name the first of them
+	for (size_t i = program->labels_size; i-- > 0;)
+		prof->label_at[program->labels[i].pc] = i + 1;
+
+	prof->started = now_nanoseconds();
+	push_frame(prof, 0);
+}
+
+void profiler_free(profiler* prof)
+{
+	free(prof->counts);
+	free(prof->labels);
+	free(prof->label_at);
+	free(prof->frames);
+}
+
+void profile_call(profiler* prof, size_t target)
+{
+	size_t label = target < prof->program->size ? prof->label_at[target] : 0;
+	push_frame(prof, label ? label : prof->program->labels_size + 1);
+}
+
+void profile_return(profiler* prof)
+{
+	// a 帰 without a matching 呼 jumps to an address the program pushed itself
+	if (prof->frames_size > 1)
+		pop_frame(prof);
+}
+
+static const char* label_name(const profiler* prof, size_t label)
+{
+	if (label == 0)
+		return "(top level)";
+	if (label > prof->program->labels_size)
+		return "(unlabelled)";
+	return prof->program->string_data + prof->program->labels[label - 1].name;
+}
+
+typedef struct {
+	size_t index;
+	uint64_t key;
+} ranked;
+
+static int compare_ranked(const void* a, const void* b)
+{
+	const ranked* x = a;
+	const ranked* y = b;
+	if (x->key != y->key)
+		return x->key < y->key ? 1 : -1;
+	return (x->index > y->index) - (x->index < y->index);
+}
+
+void profile_report(profiler* prof, FILE* file)
+{
+	const kyou_program* program = prof->program;
+	size_t labels_size = program->labels_size + 2;
+
+	while (prof->frames_size)
+		pop_frame(prof);
+
+	uint64_t total = 0;
+	for (size_t pc = 0; pc < program->size; ++pc)
+		total += prof->counts[pc];
+	fprintf(file, "profile: %llu instructions in %.3f ms\n", (unsigned long long)total, (now_nanoseconds() - prof->started) / 1e6);
+
+	ranked* order = malloc(sizeof(ranked) * (labels_size > program->size ? labels_size : program->size));
+	size_t size = 0;
+	for (size_t i = 0; i < labels_size; ++i)
+		if (prof->labels[i].calls)
+			order[size++] = (ranked){ i, prof->labels[i].exclusive };
+	qsort(order, size, sizeof(ranked), compare_ranked);
+
+	fprintf(file, "labels by exclusive time:\n");
+	fprintf(file, "  %10s %10s %12s  %-10s %s\n", "self ms", "total ms", "calls", "line:col", "label");
+	for (size_t i = 0; i < size; ++i) {
+		size_t label = order[i].index;
+		const label_profile* l = &prof->labels[label];
+		kyou_position at = { 0 };
+		if (label == 0 && program->size)
+			at = program->positions[0];
+		else if (label <= program->labels_size && program->labels[label - 1].pc < program->size)
+			at = program->positions[program->labels[label - 1].pc];
+
+		char position[24];
+		snprintf(position, sizeof(position), "%u:%u", at.line, at.col);
+		fprintf(file, "  %10.3f %10.3f %12llu  %-10s %s\n", l->exclusive / 1e6, l->inclusive / 1e6,
+			(unsigned long long)l->calls, position, label_name(prof, label));
+	}
+
+	size = 0;
+	for (size_t pc = 0; pc < program->size; ++pc)
+		if (prof->counts[pc])
+			order[size++] = (ranked){ pc, prof->counts[pc] };
+	qsort(order, size, sizeof(ranked), compare_ranked);
+
+	fprintf(file, "hottest instructions:\n");
+	fprintf(file, "  %12s %8s  %-10s %-16s %s\n", "executed", "pc", "line:col", "opcode", "label");
+	for (size_t i = 0; i < size && i < PROFILE_TOP_INSTRUCTIONS; ++i) {
+		size_t pc = order[i].index;
+		kyou_position at = program->positions[pc];
+
+		char position[24];
+		snprintf(position, sizeof(position), "%u:%u", at.line, at.col);
+		fprintf(file, "  %12llu %8zu  %-10s %-16s %s\n", (unsigned long long)order[i].key, pc, position,
+			opcode_names[opcode_unfused(program->code[pc].opcode)], label_name(prof, program_label_at(program, pc)));
+	}
+
+	free(order);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "bytecode.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// instructions listed by profile_report, hottest first
+#define PROFILE_TOP_INSTRUCTIONS 30
+
+// time spent in one label: inclusive counts each outermost activation once,
+// exclusive leaves out the labels it called
+typedef struct {
+	uint64_t calls;
+	uint64_t inclusive, exclusive; // nanoseconds
+	uint32_t active; // activations on the call stack right now
+} label_profile;
+
+typedef struct {
+	size_t label; // index in labels
+	uint64_t entered;
+	uint64_t children; // nanoseconds spent in labels called from this frame
+} profile_frame;
+
+// state of a --profile run: execution counts of every instruction and a
+// shadow call stack following 呼 and 帰
+typedef struct {
+	const kyou_program* program;
+	uint64_t* counts;
+	// labels[0] is the top level, labels[i + 1] program->labels[i] and the
+	// last one collects calls to addresses without a label
+	label_profile* labels;
+	uint32_t* label_at; // index in labels for every pc, 0 where no label starts
+	profile_frame* frames;
+	size_t frames_size, frames_capacity;
+	uint64_t started;
+} profiler;
+
+void profiler_init(profiler* prof, const kyou_program* program);
+void profiler_free(profiler* prof);
+
+// called by the profiling loop before jumping to a callee and after a return
+void profile_call(profiler* prof, size_t target);
+void profile_return(profiler* prof);
+
+// closes the frames still open and prints labels by exclusive time and the
+// hottest instructions, with the source position they were lowered from
+void profile_report(profiler* prof, FILE* file);
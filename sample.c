@@ -0,0 +1,158 @@
+#define _GNU_SOURCE
+#include "sample.h"
+
+#include "hash.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+// the timer signals the thread that armed it, which only ever runs one sampler
+static _Thread_local sampler* current;
+
+static void on_sigprof(int signal)
+{
+	(void)signal;
+	if (current)
+		current->pending = 1;
+}
+
+sample_result_t sampler_start(sampler* s, const kyou_program* program, const kyou_stack* stack, unsigned rate)
+{
+	*s = (sampler){ .program = program, .stack = stack, .index = hash_create(djb2, string_equals, 256) };
+
+	if (stack_create(&s->returns, stack->size) != STACK_SUCCESS)
+		return SAMPLE_ERROR;
+	s->returns_offset = s->returns.base - stack->base;
+
+	struct sigaction action = { .sa_handler = on_sigprof, .sa_flags = SA_RESTART };
+	sigemptyset(&action.sa_mask);
+	if (sigaction(SIGPROF, &action, NULL) != 0) {
+		fprintf(stderr, "error: could not install the SIGPROF handler\n");
+		return SAMPLE_ERROR;
+	}
+
+	struct sigevent event = { .sigev_notify = SIGEV_THREAD_ID, .sigev_signo = SIGPROF };
+	event.sigev_notify_thread_id = gettid();
+	if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &s->timer) != 0) {
+		fprintf(stderr, "error: could not create the sampling timer\n");
+		return SAMPLE_ERROR;
+	}
+
+	rate = rate ? rate : SAMPLE_DEFAULT_RATE;
+	long interval = 1000000000L / rate;
+	struct itimerspec spec = {
+		.it_interval = { interval / 1000000000L, interval % 1000000000L },
+		.it_value = { interval / 1000000000L, interval % 1000000000L }
+	};
+	current = s;
+	if (timer_settime(s->timer, 0, &spec, NULL) != 0) {
+		fprintf(stderr, "error: could not start the sampling timer\n");
+		timer_delete(s->timer);
+		current = NULL;
+		return SAMPLE_ERROR;
+	}
+	s->running = 1;
+	return SAMPLE_SUCCESS;
+}
+
+void sampler_stop(sampler* s)
+{
+	if (s->running) {
+		timer_delete(s->timer);
+		s->running = 0;
+	}
+	current = NULL;
+}
+
+void sampler_free(sampler* s)
+{
+	sampler_stop(s);
+	for (size_t i = 0; i < s->stacks_size; ++i)
+		free(s->stacks[i]);
+	if (s->returns.mapping)
+		stack_destroy(&s->returns);
+	free(s->stacks);
+	free(s->counts);
+	if (s->index)
+		hash_delete(s->index);
+}
+
+static const char* label_name(const kyou_program* program, size_t pc)
+{
+	size_t label = program_label_at(program, pc);
+	return label ? program->string_data + program->labels[label - 1].name : "(top level)";
+}
+
+// a return address is the pc right after a call
+static int is_return_address(const kyou_program* program, int64_t value)
+{
+	if (value <= 0 || (uint64_t)value >= program->size)
+		return 0;
+	uint8_t opcode = program->code[value - 1].opcode;
+	return opcode == OPCODE_CALL || opcode == OPCODE_CALL_REG;
+}
+
+static void count_stack(sampler* s, char* stack)
+{
+	size_t index = (size_t)hash_get(s->index, stack);
+	if (index) {
+		s->counts[index - 1]++;
+		free(stack);
+		return;
+	}
+
+	if (s->stacks_size == s->stacks_capacity) {
+		s->stacks_capacity = s->stacks_capacity ? 2 * s->stacks_capacity : 64;
+		s->stacks = realloc(s->stacks, sizeof(char*) * s->stacks_capacity);
+		s->counts = realloc(s->counts, sizeof(uint64_t) * s->stacks_capacity);
+	}
+	s->stacks[s->stacks_size] = stack;
+	s->counts[s->stacks_size] = 1;
+	hash_add(s->index, stack, (void*)(s->stacks_size + 1));
+	if (++s->stacks_size > s->index->size)
+		hash_resize(s->index, 2 * s->index->size);
+}
+
+void sampler_take(sampler* s, size_t pc, const int64_t* top)
+{
+	const kyou_program* program = s->program;
+	size_t frames[SAMPLE_MAX_DEPTH];
+	size_t depth = 0;
+
+	s->pending = 0;
+	++s->samples;
+
+	frames[depth++] = pc;
+	const int64_t* base = (const int64_t*)s->stack->base;
+	for (const int64_t* slot = top - 1; slot >= base && top - slot <= SAMPLE_MAX_SCAN && depth < SAMPLE_MAX_DEPTH; --slot) {
+		// a pushed value overwrote the slot unless it still matches its copy
+		if (*slot == *(const int64_t*)((const char*)slot + s->returns_offset) && is_return_address(program, *slot))
+			frames[depth++] = *slot - 1;
+	}
+
+	size_t length = 0;
+	for (size_t i = 0; i < depth; ++i)
+		length += strlen(label_name(program, frames[i])) + 1;
+
+	char* stack = malloc(length);
+	char* p = stack;
+	for (size_t i = depth; i-- > 0;) {
+		const char* name = label_name(program, frames[i]);
+		size_t size = strlen(name);
+		memcpy(p, name, size);
+		p += size;
+		*p++ = i ? ';' : '\0';
+	}
+	count_stack(s, stack);
+}
+
+void sampler_write(const sampler* s, FILE* file)
+{
+	for (size_t i = 0; i < s->stacks_size; ++i)
+		fprintf(file, "%s %llu\n", s->stacks[i], (unsigned long long)s->counts[i]);
+}
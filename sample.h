@@ -0,0 +1,60 @@
+#pragma once
+
+#include "bytecode.h"
+#include "stack.h"
+
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#define SAMPLE_DEFAULT_RATE 1000
+// innermost frames kept per sample and stack slots looked at to find them
+#define SAMPLE_MAX_DEPTH 128
+#define SAMPLE_MAX_SCAN 65536
+
+// statistical profiler for --sample: a CPU time timer of the running thread
+// raises SIGPROF, the handler only sets pending and the sampling loop takes
+// the sample at its next jump or call, where pc and the storage stack agree.
+// Pushed values can look just like return addresses, so the loop also copies
+// every return address it pushes into returns, at the same offset as on the
+// storage stack; a slot holds a return address while both still agree
+typedef struct {
+	const kyou_program* program;
+	volatile sig_atomic_t pending;
+	timer_t timer;
+	int running;
+
+	const kyou_stack* stack;
+	kyou_stack returns;
+	ptrdiff_t returns_offset; // from a slot of stack to the same slot of returns
+
+	struct hash_table* index; // collapsed stack -> index in stacks + 1
+	char** stacks;
+	uint64_t* counts;
+	size_t stacks_size, stacks_capacity;
+	uint64_t samples;
+} sampler;
+
+typedef enum { SAMPLE_SUCCESS, SAMPLE_ERROR } sample_result_t;
+
+// arms the timer to fire rate times per second of CPU time of the calling
+// thread, for a program running on stack
+sample_result_t sampler_start(sampler* s, const kyou_program* program, const kyou_stack* stack, unsigned rate);
+void sampler_stop(sampler* s);
+void sampler_free(sampler* s);
+
+// called by the sampling loop right after pushing a return address to slot
+static inline void sampler_call(sampler* s, const int64_t* slot)
+{
+	*(int64_t*)((char*)slot + s->returns_offset) = *slot;
+}
+
+// records the labels of pc and of the return addresses on the storage stack
+// below top, called by the sampling loop at its next jump or call once
+// pending is set
+void sampler_take(sampler* s, size_t pc, const int64_t* top);
+
+// writes "outer;inner count" lines, the folded format of flame graph tools
+void sampler_write(const sampler* s, FILE* file);
@@ -0,0 +1,218 @@
+#include "scan.h"
+
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+static int is_space(unsigned char ch)
+{
+	return ch == ' ' || (unsigned char)(ch - '\t') <= '\r' - '\t';
+}
+
+// moves line and col from p to q given the newlines in between, last being
+// the last of them or NULL
+static void advance(const char* p, const char* q, const char* last, uint32_t newlines, uint32_t* line, uint32_t* col)
+{
+	*line += newlines;
+	if (last)
+		*col = q - last;
+	else
+		*col += q - p;
+}
+
+static const char* scalar_spaces(const char* p, const char* end, uint32_t* line, uint32_t* col)
+{
+	const char* q = p;
+	const char* last = NULL;
+	uint32_t newlines = 0;
+	for (; q < end && is_space(*q); ++q) {
+		if (*q == '\n') {
+			last = q;
+			++newlines;
+		}
+	}
+	advance(p, q, last, newlines, line, col);
+	return q;
+}
+
+static const char* scalar_line_end(const char* p, const char* end)
+{
+	const char* q = memchr(p, '\n', end - p);
+	return q ? q : end;
+}
+
+static const char* scalar_ascii(const char* p, const char* end, uint32_t* line, uint32_t* col)
+{
+	const char* q = p;
+	const char* last = NULL;
+	uint32_t newlines = 0;
+	for (; q < end && !(*q & 0x80); ++q) {
+		if (*q == '\n') {
+			last = q;
+			++newlines;
+		}
+	}
+	advance(p, q, last, newlines, line, col);
+	return q;
+}
+
+const scanner scan_scalar = { scalar_spaces, scalar_line_end, scalar_ascii };
+
+#if defined(__x86_64__)
+
+// the vector loops work on whole blocks and leave the tail to the scalar ones;
+// newlines are counted with a mask of the '\n' bytes of a block cut off at
+// the byte that ended the run
+#define NEWLINES(mask, block) do {\
+		if (mask) {\
+			newlines += __builtin_popcount(mask);\
+			last = (block) + 31 - __builtin_clz(mask);\
+		}\
+	} while (0)
+
+// bytes of v that are whitespace: ' ' or '\t' to '\r'
+static inline __m128i sse2_is_space(__m128i v)
+{
+	__m128i shifted = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+	__m128i range = _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8('\r' - '\t')), shifted);
+	return _mm_or_si128(range, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+}
+
+static const char* sse2_spaces(const char* p, const char* end, uint32_t* line, uint32_t* col)
+{
+	const char* q = p;
+	const char* last = NULL;
+	uint32_t newlines = 0;
+	for (; end - q >= 16; q += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)q);
+		uint32_t stop = ~_mm_movemask_epi8(sse2_is_space(v)) & 0xFFFF;
+		uint32_t nl = _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+		if (stop) {
+			nl &= (1u << __builtin_ctz(stop)) - 1;
+			NEWLINES(nl, q);
+			advance(p, q + __builtin_ctz(stop), last, newlines, line, col);
+			return q + __builtin_ctz(stop);
+		}
+		NEWLINES(nl, q);
+	}
+	advance(p, q, last, newlines, line, col);
+	return scalar_spaces(q, end, line, col);
+}
+
+static const char* sse2_line_end(const char* p, const char* end)
+{
+	for (; end - p >= 16; p += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)p);
+		uint32_t nl = _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+		if (nl)
+			return p + __builtin_ctz(nl);
+	}
+	return scalar_line_end(p, end);
+}
+
+static const char* sse2_ascii(const char* p, const char* end, uint32_t* line, uint32_t* col)
+{
+	const char* q = p;
+	const char* last = NULL;
+	uint32_t newlines = 0;
+	for (; end - q >= 16; q += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)q);
+		uint32_t stop = _mm_movemask_epi8(v);
+		uint32_t nl = _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+		if (stop) {
+			nl &= (1u << __builtin_ctz(stop)) - 1;
+			NEWLINES(nl, q);
+			advance(p, q + __builtin_ctz(stop), last, newlines, line, col);
+			return q + __builtin_ctz(stop);
+		}
+		NEWLINES(nl, q);
+	}
+	advance(p, q, last, newlines, line, col);
+	return scalar_ascii(q, end, line, col);
+}
+
+static const scanner sse2_scanner = { sse2_spaces, sse2_line_end, sse2_ascii };
+
+#define AVX2 __attribute__((target("avx2")))
+
+static inline AVX2 __m256i avx2_is_space(__m256i v)
+{
+	__m256i shifted = _mm256_sub_epi8(v, _mm256_set1_epi8('\t'));
+	__m256i range = _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, _mm256_set1_epi8('\r' - '\t')), shifted);
+	return _mm256_or_si256(range, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')));
+}
+
+// the stop bit of a block of 32 can be bit 31, so the mask of the bytes
+// before it is built in 64 bits
+static AVX2 const char* avx2_spaces(const char* p, const char* end, uint32_t* line, uint32_t* col)
+{
+	const char* q = p;
+	const char* last = NULL;
+	uint32_t newlines = 0;
+	for (; end - q >= 32; q += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)q);
+		uint32_t stop = ~(uint32_t)_mm256_movemask_epi8(avx2_is_space(v));
+		uint32_t nl = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+		if (stop) {
+			nl &= (uint32_t)((1ull << __builtin_ctz(stop)) - 1);
+			NEWLINES(nl, q);
+			advance(p, q + __builtin_ctz(stop), last, newlines, line, col);
+			return q + __builtin_ctz(stop);
+		}
+		NEWLINES(nl, q);
+	}
+	advance(p, q, last, newlines, line, col);
+	return sse2_spaces(q, end, line, col);
+}
+
+static AVX2 const char* avx2_line_end(const char* p, const char* end)
+{
+	for (; end - p >= 32; p += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)p);
+		uint32_t nl = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+		if (nl)
+			return p + __builtin_ctz(nl);
+	}
+	return sse2_line_end(p, end);
+}
+
+static AVX2 const char* avx2_ascii(const char* p, const char* end, uint32_t* line, uint32_t* col)
+{
+	const char* q = p;
+	const char* last = NULL;
+	uint32_t newlines = 0;
+	for (; end - q >= 32; q += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)q);
+		uint32_t stop = _mm256_movemask_epi8(v);
+		uint32_t nl = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+		if (stop) {
+			nl &= (uint32_t)((1ull << __builtin_ctz(stop)) - 1);
+			NEWLINES(nl, q);
+			advance(p, q + __builtin_ctz(stop), last, newlines, line, col);
+			return q + __builtin_ctz(stop);
+		}
+		NEWLINES(nl, q);
+	}
+	advance(p, q, last, newlines, line, col);
+	return sse2_ascii(q, end, line, col);
+}
+
+static const scanner avx2_scanner = { avx2_spaces, avx2_line_end, avx2_ascii };
+
+const scanner* scanner_select(void)
+{
+	// SSE2 is part of x86-64 itself
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") ? &avx2_scanner : &sse2_scanner;
+}
+
+#else
+
+const scanner* scanner_select(void)
+{
+	return &scan_scalar;
+}
+
+#endif
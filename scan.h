@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+
+// fast paths of the tokenizer over the ASCII runs that make up most of a
+// source: whitespace, # comments and the text of string literals. Each
+// function returns the first byte of [p, end) that ends its run, or end, and
+// the ones taking line and col move them over the bytes skipped
+typedef struct {
+	// to the next non-whitespace byte
+	const char* (*spaces)(const char* p, const char* end, uint32_t* line, uint32_t* col);
+	// to the next '\n', without counting anything
+	const char* (*line_end)(const char* p, const char* end);
+	// to the next byte with the high bit set, that is the next non-ASCII one
+	const char* (*ascii)(const char* p, const char* end, uint32_t* line, uint32_t* col);
+} scanner;
+
+// the fastest scanner the CPU supports: AVX2, SSE2 or plain C
+const scanner* scanner_select(void);
+// the plain C fallback
+extern const scanner scan_scalar;
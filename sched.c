@@ -0,0 +1,46 @@
+#include "sched.h"
+
+#include <stdlib.h>
+
+void scheduler_init(scheduler* s, uint64_t slice)
+{
+	*s = (scheduler){ .slice = slice };
+}
+
+void scheduler_free(scheduler* s)
+{
+	free(s->ring);
+	*s = (scheduler){ 0 };
+}
+
+void scheduler_add(scheduler* s, kyou_vm* vm)
+{
+	if (s->size == s->capacity) {
+		size_t capacity = s->capacity ? 2 * s->capacity : 16;
+		kyou_vm** ring = malloc(sizeof(kyou_vm*) * capacity);
+		for (size_t i = 0; i < s->size; ++i)
+			ring[i] = s->ring[(s->head + i) % s->capacity];
+		free(s->ring);
+		s->ring = ring;
+		s->capacity = capacity;
+		s->head = 0;
+	}
+	s->ring[(s->head + s->size++) % s->capacity] = vm;
+}
+
+kyou_vm* scheduler_run(scheduler* s, vm_status_t* status)
+{
+	if (s->size == 0)
+		return NULL;
+
+	kyou_vm* vm = s->ring[s->head];
+	s->head = (s->head + 1) % s->capacity;
+	--s->size;
+
+	*status = vm_run_fuel(vm, s->slice);
+	if (*status == VM_PAUSED) {
+		scheduler_add(s, vm);
+		return NULL;
+	}
+	return vm;
+}
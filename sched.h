@@ -0,0 +1,19 @@
+#pragma once
+
+#include "interpret.h"
+
+// green threads for one OS thread: runnable VMs take turns in a ring, each
+// running for slice fuel before it yields to the next one
+typedef struct {
+	kyou_vm** ring;
+	size_t capacity, head, size;
+	uint64_t slice;
+} scheduler;
+
+void scheduler_init(scheduler* s, uint64_t slice);
+void scheduler_free(scheduler* s);
+
+void scheduler_add(scheduler* s, kyou_vm* vm);
+// runs the VM at the front for one slice; returns it with its status once it
+// halted or failed, or NULL when it yielded and went to the back of the ring
+kyou_vm* scheduler_run(scheduler* s, vm_status_t* status);
@@ -0,0 +1,97 @@
+#include "stack.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+static _Thread_local const kyou_stack* guarded;
+static _Thread_local sigjmp_buf* recover;
+static struct sigaction previous;
+static pthread_once_t installed = PTHREAD_ONCE_INIT;
+
+static void segv_handler(int sig, siginfo_t* info, void* context)
+{
+	const kyou_stack* stack = guarded;
+	char* addr = info->si_addr;
+
+	if (stack) {
+		if (addr >= stack->base + stack->size && addr < stack->mapping + stack->mapping_size)
+			siglongjmp(*recover, STACK_OVERFLOW);
+		if (addr >= stack->mapping && addr < stack->base)
+			siglongjmp(*recover, STACK_UNDERFLOW);
+	}
+
+	// not ours, hand it to whoever had the signal before us. Under the default
+	// action or SIG_IGN the fault repeats without us and crashes as usual
+	if (previous.sa_flags & SA_SIGINFO) {
+		previous.sa_sigaction(sig, info, context);
+	} else if (previous.sa_handler == SIG_DFL || previous.sa_handler == SIG_IGN) {
+		sigaction(sig, &previous, NULL);
+	} else {
+		previous.sa_handler(sig);
+	}
+}
+
+static void install_handler(void)
+{
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_sigaction = segv_handler;
+	// SA_NODEFER leaves SIGSEGV unblocked once we jump out of the handler,
+	// so sigsetjmp needs not save the signal mask on every run
+	action.sa_flags = SA_SIGINFO | SA_NODEFER | SA_ONSTACK;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGSEGV, &action, &previous);
+}
+
+stack_result_t stack_create(kyou_stack* stack, size_t size)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	size = (size + page - 1) / page * page;
+	if (size == 0)
+		size = page;
+
+	char* mapping = mmap(NULL, size + 2 * page, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (mapping == MAP_FAILED) {
+		fprintf(stderr, "error: could not reserve %zu bytes for the stack\n", size);
+		return STACK_ERROR;
+	}
+
+	if (mprotect(mapping + page, size, PROT_READ | PROT_WRITE) != 0) {
+		fprintf(stderr, "error: could not map the stack\n");
+		munmap(mapping, size + 2 * page);
+		return STACK_ERROR;
+	}
+
+	stack->mapping = mapping;
+	stack->mapping_size = size + 2 * page;
+	stack->base = mapping + page;
+	stack->size = size;
+	return STACK_SUCCESS;
+}
+
+void stack_destroy(kyou_stack* stack)
+{
+	if (guarded == stack)
+		guarded = NULL;
+	munmap(stack->mapping, stack->mapping_size);
+	*stack = (kyou_stack){ 0 };
+}
+
+void stack_guard(const kyou_stack* stack, sigjmp_buf* env)
+{
+	pthread_once(&installed, install_handler);
+
+	recover = env;
+	guarded = stack;
+}
+
+void stack_unguard(void)
+{
+	guarded = NULL;
+	recover = NULL;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <setjmp.h>
+#include <stddef.h>
+
+#define STACK_DEFAULT_SIZE (1024 * 1024)
+
+// storage stack of a VM: an mmap'd region between two PROT_NONE guard pages,
+// so pushes and pops need no bounds checks and overruns fault right away
+typedef struct {
+	char* base;
+	size_t size;
+	char* mapping;
+	size_t mapping_size;
+} kyou_stack;
+
+typedef enum { STACK_SUCCESS, STACK_ERROR } stack_result_t;
+
+// reserves size bytes (rounded up to pages), memory is only committed once touched
+stack_result_t stack_create(kyou_stack* stack, size_t size);
+void stack_destroy(kyou_stack* stack);
+
+typedef enum { STACK_NO_FAULT, STACK_OVERFLOW, STACK_UNDERFLOW } stack_fault_t;
+
+// until stack_unguard, a fault in the guard pages of stack on this thread
+// jumps back to env, with sigsetjmp returning the stack_fault_t. Other faults
+// go on to the SIGSEGV handler installed before the first stack_guard
+void stack_guard(const kyou_stack* stack, sigjmp_buf* env);
+void stack_unguard(void);
@@ -0,0 +1,82 @@
+#include "symbols.h"
+
+#include "hash.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static int grow_slots(symbol_table* symbols)
+{
+	size_t slots_size = symbols->slots_size ? 2 * symbols->slots_size : 256;
+	uint32_t* slots = calloc(slots_size, sizeof(uint32_t));
+	if (slots == NULL)
+		return 0;
+
+	for (uint32_t id = 0; id < symbols->size; ++id) {
+		size_t i = symbols->hashes[id] & (slots_size - 1);
+		while (slots[i])
+			i = (i + 1) & (slots_size - 1);
+		slots[i] = id + 1;
+	}
+	free(symbols->slots);
+	symbols->slots = slots;
+	symbols->slots_size = slots_size;
+	return 1;
+}
+
+static uint32_t add_symbol(symbol_table* symbols, const char* text, size_t length, uint64_t hash)
+{
+	if (symbols->size == symbols->capacity) {
+		uint32_t capacity = symbols->capacity ? 2 * symbols->capacity : 64;
+		const char** names = realloc(symbols->names, sizeof(char*) * capacity);
+		if (names == NULL)
+			return SYMBOL_NONE;
+		symbols->names = names;
+		uint64_t* hashes = realloc(symbols->hashes, sizeof(uint64_t) * capacity);
+		if (hashes == NULL)
+			return SYMBOL_NONE;
+		symbols->hashes = hashes;
+		symbols->capacity = capacity;
+	}
+
+	const char* name = arena_strndup(&symbols->text, text, length);
+	if (name == NULL)
+		return SYMBOL_NONE;
+	symbols->names[symbols->size] = name;
+	symbols->hashes[symbols->size] = hash;
+	return symbols->size++;
+}
+
+uint32_t symbol_intern(symbol_table* symbols, const char* text, size_t length)
+{
+	if (2 * (symbols->size + 1) > symbols->slots_size && !grow_slots(symbols))
+		return SYMBOL_NONE;
+
+	uint64_t hash = fnv1a(text, length);
+	size_t i = hash & (symbols->slots_size - 1);
+	for (; symbols->slots[i]; i = (i + 1) & (symbols->slots_size - 1)) {
+		uint32_t id = symbols->slots[i] - 1;
+		const char* name = symbols->names[id];
+		if (symbols->hashes[id] == hash && strncmp(name, text, length) == 0 && name[length] == 0)
+			return id;
+	}
+
+	uint32_t id = add_symbol(symbols, text, length, hash);
+	if (id != SYMBOL_NONE)
+		symbols->slots[i] = id + 1;
+	return id;
+}
+
+const char* symbol_name(const symbol_table* symbols, uint32_t id)
+{
+	return symbols->names[id];
+}
+
+void symbols_free(symbol_table* symbols)
+{
+	free(symbols->names);
+	free(symbols->hashes);
+	free(symbols->slots);
+	arena_free(&symbols->text);
+	*symbols = SYMBOL_TABLE_EMPTY;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "arena.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SYMBOL_NONE UINT32_MAX
+
+// identifiers of a compilation interned into dense ids, 0 to size - 1, so
+// that whatever is kept per label can be an array indexed by its id
+typedef struct
+{
+	const char** names; // by id, terminated copies in text
+	uint64_t* hashes; // by id
+	uint32_t size, capacity;
+
+	uint32_t* slots; // open addressing, id + 1 or 0 when empty
+	size_t slots_size; // a power of two, at least twice size
+	arena text;
+} symbol_table;
+
+#define SYMBOL_TABLE_EMPTY (symbol_table) { .text = ARENA_EMPTY }
+
+// id of the length bytes at text, adding them the first time they are seen,
+// SYMBOL_NONE when out of memory
+uint32_t symbol_intern(symbol_table* symbols, const char* text, size_t length);
+const char* symbol_name(const symbol_table* symbols, uint32_t id);
+void symbols_free(symbol_table* symbols);
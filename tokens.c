@@ -1,43 +1,135 @@
 #include "tokens.h"
 
+#include "scan.h"
 #include "utf8.h"
 
 #include <ctype.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <string.h>
 
-static int add_token(tokens* toks, token t)
+// every kanji the language uses is a CJK unified ideograph, so one byte per
+// code point of that block says what it stands for: 0 for nothing, a token
+// type + 1, or for numerals the high bit with their level and digit, level 1
+// being the digits and levels 2 to 5 ten to ten thousand
+#define KANJI_FIRST 0x4E00
+#define KANJI_LAST 0x9FFF
+
+#define KANJI_NUMERAL_BIT 0x80
+#define KANJI_TOKEN(type) ((type) + 1)
+#define KANJI_NUMERAL(level, digit) (KANJI_NUMERAL_BIT | (level) << 4 | (digit))
+#define KANJI_LEVEL(entry) (((entry) >> 4) & 0x7)
+#define KANJI_DIGIT(entry) ((entry) & 0xF)
+
+#define KANJI(code_point) [(code_point) - KANJI_FIRST]
+
+static const uint8_t kanji_table[KANJI_LAST - KANJI_FIRST + 1] = {
+	KANJI(0x65E5) = KANJI_TOKEN(TOKEN_SUN), // 日
+	KANJI(0x6708) = KANJI_TOKEN(TOKEN_MOON), // 月
+	KANJI(0x661F) = KANJI_TOKEN(TOKEN_STARS), // 星
+
+	KANJI(0x54C1) = KANJI_TOKEN(TOKEN_STORAGE_BASE), // 品, 品台 when 台 follows
+
+	KANJI(0x706B) = KANJI_TOKEN(TOKEN_FIRE), // 火
+	KANJI(0x6C34) = KANJI_TOKEN(TOKEN_WATER), // 水
+	KANJI(0x6728) = KANJI_TOKEN(TOKEN_TREE), // 木
+	KANJI(0x571F) = KANJI_TOKEN(TOKEN_EARTH), // 土
+	KANJI(0x91D1) = KANJI_TOKEN(TOKEN_METAL), // 金
+
+	KANJI(0x6625) = KANJI_TOKEN(TOKEN_SPRING), // 春
+	KANJI(0x590F) = KANJI_TOKEN(TOKEN_SUMMER), // 夏
+	KANJI(0x79CB) = KANJI_TOKEN(TOKEN_AUTUMN), // 秋
+	KANJI(0x51AC) = KANJI_TOKEN(TOKEN_WINTER), // 冬
+	KANJI(0x6587) = KANJI_TOKEN(TOKEN_STRING_TYPE), // 文
+	KANJI(0x5B57) = KANJI_TOKEN(TOKEN_CHAR), // 字
+
+	KANJI(0x52D5) = KANJI_TOKEN(TOKEN_MOVE), // 動
+	KANJI(0x62BC) = KANJI_TOKEN(TOKEN_PUSH), // 押
+	KANJI(0x5F3E) = KANJI_TOKEN(TOKEN_POP), // 弾
+	KANJI(0x547C) = KANJI_TOKEN(TOKEN_CALL), // 呼
+	KANJI(0x5E30) = KANJI_TOKEN(TOKEN_RETURN), // 帰
+
+	KANJI(0x8DB3) = KANJI_TOKEN(TOKEN_ADD), // 足
+	KANJI(0x5F15) = KANJI_TOKEN(TOKEN_SUB), // 引
+	KANJI(0x639B) = KANJI_TOKEN(TOKEN_MUL), // 掛
+	KANJI(0x5272) = KANJI_TOKEN(TOKEN_DIV), // 割
+	KANJI(0x4F59) = KANJI_TOKEN(TOKEN_MOD), // 余
+	KANJI(0x6216) = KANJI_TOKEN(TOKEN_OR), // 或
+	KANJI(0x5171) = KANJI_TOKEN(TOKEN_AND), // 共
+	KANJI(0x6392) = KANJI_TOKEN(TOKEN_XOR), // 排
+
+	KANJI(0x672D) = KANJI_TOKEN(TOKEN_LABEL), // 札
+	KANJI(0x5225) = KANJI_TOKEN(TOKEN_BRANCH), // 別
+	KANJI(0x5E38) = KANJI_TOKEN(TOKEN_ALWAYS), // 常
+	KANJI(0x7B49) = KANJI_TOKEN(TOKEN_EQUALS), // 等
+	KANJI(0x5927) = KANJI_TOKEN(TOKEN_GREATER), // 大
+	KANJI(0x5C0F) = KANJI_TOKEN(TOKEN_LESS), // 小
+
+	KANJI(0x970A) = KANJI_NUMERAL(1, 0), // 霊
+	KANJI(0x4E00) = KANJI_NUMERAL(1, 1), // 一
+	KANJI(0x4E8C) = KANJI_NUMERAL(1, 2), // 二
+	KANJI(0x4E09) = KANJI_NUMERAL(1, 3), // 三
+	KANJI(0x56DB) = KANJI_NUMERAL(1, 4), // 四
+	KANJI(0x4E94) = KANJI_NUMERAL(1, 5), // 五
+	KANJI(0x516D) = KANJI_NUMERAL(1, 6), // 六
+	KANJI(0x4E03) = KANJI_NUMERAL(1, 7), // 七
+	KANJI(0x516B) = KANJI_NUMERAL(1, 8), // 八
+	KANJI(0x4E5D) = KANJI_NUMERAL(1, 9), // 九
+	KANJI(0x5341) = KANJI_NUMERAL(2, 0), // 十
+	KANJI(0x767E) = KANJI_NUMERAL(3, 0), // 百
+	KANJI(0x5343) = KANJI_NUMERAL(4, 0), // 千
+	KANJI(0x4E07) = KANJI_NUMERAL(5, 0), // 万
+};
+
+static const int64_t kanji_magnitudes[] = { 0, 1, 10, 100, 1000, 10000 };
+
+#define KANJI_STORAGE_SECOND 0x53F0 // 台 of 品台
+#define KANJI_OPEN_QUOTE_CODE_POINT 0x300C
+#define KANJI_CLOSE_QUOTE_CODE_POINT 0x300D
+
+static uint8_t kanji_lookup(uint32_t code_point)
 {
-	toks->data = realloc(toks->data, sizeof(token) * ++toks->size);
-	if (toks->data == NULL)
+	if (code_point < KANJI_FIRST || code_point > KANJI_LAST)
 		return 0;
-	toks->data[toks->size-1] = t;
+	return kanji_table[code_point - KANJI_FIRST];
+}
+
+static int add_token(tokens* toks, token t)
+{
+	if (toks->size == toks->capacity) {
+		size_t capacity = toks->capacity ? 2 * toks->capacity : 1024;
+		token* data = realloc(toks->data, sizeof(token) * capacity);
+		if (data == NULL)
+			return 0;
+		toks->data = data;
+		toks->capacity = capacity;
+	}
+	toks->data[toks->size++] = t;
 	return 1;
 }
 
-tokenize_result_t tokenize(tokens* toks, const char* data, size_t data_size)
+tokenize_result_t tokenize(tokens* toks, symbol_table* symbols, const char* data, size_t data_size)
 {
-	toks->data = NULL;
-	toks->size = 0;
+	*toks = (tokens){ 0 };
 
 	uint32_t line = 1;
 	uint32_t col = 1;
 
-	if (utf8_has_bom(data)) {
-		fprintf(stderr, "had bom\n");
+	if (utf8_has_bom(data, data_size)) {
 		data += 3;
+		data_size -= 3;
 	}
 
-	for (const char* p = data; p < data + data_size;) {
+	const scanner* scan = scanner_select();
+	const char* end = data + data_size;
+	for (const char* p = data; p < end;) {
+		// the newline ending a comment is left to the whitespace scan
 		if (*p == '#') {
-			while (*p != '\n' && *p++ != '\0');
-			++p;
-			++line;
-			col = 1;
+			p = scan->line_end(p, end);
 			continue;
 		}
 
+		// a single blank is stepped over here, only longer runs are worth a
+		// call to the vector scan
 		if (isspace(*p)) {
 			if (*p == '\n') {
 				++line;
@@ -46,142 +138,105 @@ tokenize_result_t tokenize(tokens* toks, const char* data, size_t data_size)
 				++col;
 			}
 			++p;
+			if (p < end && isspace(*p))
+				p = scan->spaces(p, end, &line, &col);
 			continue;
-		} else {
-
-#define strlit_eq(who, str) (strncmp((who), (str), utf8_size(*(str))) == 0)
-#define IS_NUMBER(p) (strlit_eq(p, KANJI_ZERO) || strlit_eq(p, KANJI_ONE) || strlit_eq(p, KANJI_TWO) || strlit_eq(p, KANJI_THREE) || strlit_eq(p, KANJI_FOUR) || strlit_eq(p, KANJI_FIVE) || strlit_eq(p, KANJI_SIX) || strlit_eq(p, KANJI_SEVEN) || strlit_eq(p, KANJI_EIGHT) || strlit_eq(p, KANJI_NINE) || strlit_eq(p, KANJI_TEN))
-#define CHECK_KANJI(_kanji, _token)	if (strlit_eq(p, _kanji)) {\
-				add_token(toks, (token) { .type = (_token), .line = line, .col = col });\
-				p += utf8_size(*(_kanji));\
-				++col;\
-				continue;\
+		}
+
+		// every character is decoded once and looked up once
+		int size;
+		uint32_t code_point = utf8_decode(p, end, &size);
+		uint8_t kanji = kanji_lookup(code_point);
+
+		if (kanji && !(kanji & KANJI_NUMERAL_BIT)) {
+			token t = { .type = kanji - 1, .line = line, .col = col };
+			p += size;
+			++col;
+
+			int next_size;
+			if (t.type == TOKEN_STORAGE_BASE && p < end && utf8_decode(p, end, &next_size) == KANJI_STORAGE_SECOND) {
+				t.type = TOKEN_STORAGE;
+				p += next_size;
+				++col;
 			}
-			CHECK_KANJI(KANJI_SUN, TOKEN_SUN);
-			CHECK_KANJI(KANJI_MOON, TOKEN_MOON);
-			CHECK_KANJI(KANJI_STARS, TOKEN_STARS);
-
-			CHECK_KANJI(KANJI_STORAGE_BASE, TOKEN_STORAGE_BASE);
-			CHECK_KANJI(KANJI_STORAGE, TOKEN_STORAGE);
-
-			CHECK_KANJI(KANJI_FIRE, TOKEN_FIRE);
-			CHECK_KANJI(KANJI_WATER, TOKEN_WATER);
-			CHECK_KANJI(KANJI_TREE, TOKEN_TREE);
-			CHECK_KANJI(KANJI_EARTH, TOKEN_EARTH);
-			CHECK_KANJI(KANJI_METAL, TOKEN_METAL);
-
-			CHECK_KANJI(KANJI_SPRING, TOKEN_SPRING);
-			CHECK_KANJI(KANJI_SUMMER, TOKEN_SUMMER);
-			CHECK_KANJI(KANJI_AUTUMN, TOKEN_AUTUMN);
-			CHECK_KANJI(KANJI_WINTER, TOKEN_WINTER);
-			CHECK_KANJI(KANJI_STRING, TOKEN_STRING_TYPE);
-			CHECK_KANJI(KANJI_CHAR, TOKEN_CHAR);
-			
-			CHECK_KANJI(KANJI_MOVE, TOKEN_MOVE);
-			CHECK_KANJI(KANJI_PUSH, TOKEN_PUSH);
-			CHECK_KANJI(KANJI_POP, TOKEN_POP);
-			CHECK_KANJI(KANJI_CALL, TOKEN_CALL);
-			CHECK_KANJI(KANJI_RETURN, TOKEN_RETURN);
-
-			CHECK_KANJI(KANJI_ADD, TOKEN_ADD);
-			CHECK_KANJI(KANJI_SUBSTRACT, TOKEN_SUB);
-			CHECK_KANJI(KANJI_MULTIPLY, TOKEN_MUL);
-			CHECK_KANJI(KANJI_DIVIDE, TOKEN_DIV);
-			CHECK_KANJI(KANJI_MODULO, TOKEN_MOD);
-			CHECK_KANJI(KANJI_OR, TOKEN_OR);
-			CHECK_KANJI(KANJI_AND, TOKEN_AND);
-			CHECK_KANJI(KANJI_XOR, TOKEN_XOR);
-
-			CHECK_KANJI(KANJI_LABEL, TOKEN_LABEL);
-			CHECK_KANJI(KANJI_BRANCH, TOKEN_BRANCH);
-			CHECK_KANJI(KANJI_ALWAYS, TOKEN_ALWAYS);
-			CHECK_KANJI(KANJI_EQUALS, TOKEN_EQUALS);
-			CHECK_KANJI(KANJI_GREATER, TOKEN_GREATER);
-			CHECK_KANJI(KANJI_LESS, TOKEN_LESS);
-
-			if (IS_NUMBER(p)) {
-				int64_t result = 0;
-				int64_t curr = 0;
-				int lvl = 0;
-				
-				const char* d = p;
-				while (IS_NUMBER(d)) {
-#define CHECK_KANJI_NUMBER(kanji, l, expr) if (strlit_eq(d, (kanji))) {\
-					if ((l) == lvl) {\
-						fprintf(stderr, "malformed number at %u, %u (l %d lvl %d)\n", line, col, (l), lvl);\
-						return TOKENIZE_ERROR;\
-					}\
-					if ((l) < lvl) {\
-						result += curr;\
-						curr = 0;\
-					}\
-					expr;\
-					lvl = (l);\
-					d += utf8_size(*kanji);\
-					++col;\
-					continue;\
-				}
+			add_token(toks, t);
+			continue;
+		}
 
-					CHECK_KANJI_NUMBER(KANJI_ZERO, 1, curr += 0);
-					CHECK_KANJI_NUMBER(KANJI_ONE, 1, curr += 1);
-					CHECK_KANJI_NUMBER(KANJI_TWO, 1, curr += 2);
-					CHECK_KANJI_NUMBER(KANJI_THREE, 1, curr += 3);
-					CHECK_KANJI_NUMBER(KANJI_FOUR, 1, curr += 4);
-					CHECK_KANJI_NUMBER(KANJI_FIVE, 1, curr += 5);
-					CHECK_KANJI_NUMBER(KANJI_SIX, 1, curr += 6);
-					CHECK_KANJI_NUMBER(KANJI_SEVEN, 1, curr += 7);
-					CHECK_KANJI_NUMBER(KANJI_EIGHT, 1, curr += 8);
-					CHECK_KANJI_NUMBER(KANJI_NINE, 1, curr += 9);
-					CHECK_KANJI_NUMBER(KANJI_TEN, 2, curr = 10 * (curr ? curr : 1));
-					CHECK_KANJI_NUMBER(KANJI_HUNDRED, 3, curr = 100 * (curr ? curr : 1));
-					CHECK_KANJI_NUMBER(KANJI_THOUSAND, 4, curr = 1000 * (curr ? curr : 1));
-					CHECK_KANJI_NUMBER(KANJI_TEN_THOUSAND, 5, curr = 10000 * (curr ? curr : 1));
+		if (kanji) {
+			int64_t result = 0;
+			int64_t curr = 0;
+			int lvl = 0;
+			uint32_t start = col;
+
+			while (kanji & KANJI_NUMERAL_BIT) {
+				int l = KANJI_LEVEL(kanji);
+				if (l == lvl) {
+					fprintf(stderr, "malformed number at %u, %u (l %d lvl %d)\n", line, col, l, lvl);
+					return TOKENIZE_ERROR;
 				}
-				result += curr;
-				add_token(toks, (token){ .type = TOKEN_NUMBER, .as_int64 = result, .line = line, .col = col});
-				p = d;
-				continue;
-			}
+				if (l < lvl) {
+					result += curr;
+					curr = 0;
+				}
+				if (l == 1)
+					curr += KANJI_DIGIT(kanji);
+				else
+					curr = kanji_magnitudes[l] * (curr ? curr : 1);
+				lvl = l;
+				p += size;
+				++col;
 
-			if (isalpha(*p)) {
-				const char* d = p;
-				while (isalnum(*d)) ++d;
-				
-				char* str = malloc(d - p + 1);
-				str[d - p] = 0;
-				strncpy(str, p, d - p);
-
-				add_token(toks, (token) { .type = TOKEN_IDENTIFIER, .as_cstr = str, .line = line, .col = col});
-				p = d;
-				col += d - p;
-				continue;
+				kanji = p < end ? kanji_lookup(utf8_decode(p, end, &size)) : 0;
 			}
+			result += curr;
+			add_token(toks, (token){ .type = TOKEN_NUMBER, .as_int64 = result, .line = line, .col = start });
+			continue;
+		}
 
-			if (strlit_eq(p, KANJI_OPEN_QUOTE)) {
-				const char* d = p + utf8_size(*KANJI_OPEN_QUOTE);
-				while (isascii(*d)) {//(isalnum(*d) || isspace(*d)) {	
-					if (*d == '\n') { ++line; col = 1; } else ++col;
-					//fprintf(stderr, "added %c to str\n", *d);
-					++d;
-				}
-				if (!strlit_eq(d, KANJI_CLOSE_QUOTE)) {
-					fprintf(stderr, "did not close string literal properly at line %u, %u\n", line, col);
-					return TOKENIZE_ERROR;
-				}// else fprintf(stderr, "closed string\n");
+		if (code_point < 0x80 && isalpha(code_point)) {
+			const char* d = p;
+			while (d < end && isalnum(*d)) ++d;
+
+			uint32_t symbol = symbol_intern(symbols, p, d - p);
+			if (symbol == SYMBOL_NONE) {
+				fprintf(stderr, "error: out of memory for identifiers at line %u, %u\n", line, col);
+				return TOKENIZE_ERROR;
+			}
 
-				char* str = malloc(d - p - utf8_size(*KANJI_OPEN_QUOTE));
-				str[d - p - utf8_size(*KANJI_OPEN_QUOTE)] = 0;
-				strncpy(str, p + utf8_size(*KANJI_OPEN_QUOTE), d - p - utf8_size(*KANJI_OPEN_QUOTE));
+			add_token(toks, (token) { .type = TOKEN_IDENTIFIER, .as_symbol = symbol, .line = line, .col = col});
+			col += d - p;
+			p = d;
+			continue;
+		}
 
-				add_token(toks, (token) { .type = TOKEN_STRING, .as_cstr = str, .line = line, .col = col});
-				//fprintf(stderr, "resulted in %s\n", str);
-				p = d + utf8_size(*KANJI_CLOSE_QUOTE); // d should point to CLOSE_QUOTE
-				continue;
+		if (code_point == KANJI_OPEN_QUOTE_CODE_POINT) {
+			token t = { .type = TOKEN_STRING, .line = line, .col = col };
+			const char* d = p + size;
+			++col;
+			d = scan->ascii(d, end, &line, &col);
+			int close_size = 0;
+			if (d >= end || utf8_decode(d, end, &close_size) != KANJI_CLOSE_QUOTE_CODE_POINT) {
+				fprintf(stderr, "did not close string literal properly at line %u, %u\n", line, col);
+				return TOKENIZE_ERROR;
 			}
-			fprintf(stderr, "unknown symbol at line %u, %u\n", line, col);
-			return TOKENIZE_ERROR;
+
+			t.as_text = p + size;
+			t.length = d - p - size;
+			add_token(toks, t);
+			p = d + close_size;
+			++col;
+			continue;
 		}
+		fprintf(stderr, "unknown symbol at line %u, %u\n", line, col);
+		return TOKENIZE_ERROR;
 	}
 	add_token(toks, (token) { .type = TOKEN_EOF, .line = line, .col = col });
 	return TOKENIZE_SUCCESS;
 }
+
+void tokens_free(tokens* toks)
+{
+	free(toks->data);
+	*toks = (tokens){ 0 };
+}
@@ -1,5 +1,7 @@
 ﻿#pragma once
 
+#include "symbols.h"
+
 #include <stddef.h>
 #include <stdint.h>
 
@@ -129,13 +131,15 @@ token_type;
 typedef struct
 {
 	token_type type;
+	uint32_t length; // of the text of strings
 	union {
 		int8_t as_int8;
 		int16_t as_int16;
 		int32_t as_int32;
 		int64_t as_int64;
 		void* as_ptr;
-		const char* as_cstr;
+		uint32_t as_symbol; // identifiers
+		const char* as_text; // strings: a slice of the source, not terminated
 	};
 	uint32_t line, col; // hopefully nobody has more than 4 mln lines of code in a file
 }
@@ -144,10 +148,13 @@ token;
 typedef struct
 {
 	token* data;
-	size_t size;
+	size_t size, capacity;
 }
 tokens;
 
 typedef enum { TOKENIZE_SUCCESS, TOKENIZE_ERROR } tokenize_result_t;
 
-tokenize_result_t tokenize(tokens* output, const char* data, size_t data_size);
+// identifiers are interned into symbols, the texts of string tokens point
+// into data, which has to outlive them; nothing past data_size is read
+tokenize_result_t tokenize(tokens* output, symbol_table* symbols, const char* data, size_t data_size);
+void tokens_free(tokens* toks);
@@ -0,0 +1,78 @@
+#include "trace.h"
+
+#include "fuse.h"
+
+#include <stdlib.h>
+
+void trace_cache_init(trace_cache* cache, const kyou_program* program, kyou_output* output, uint32_t threshold)
+{
+	cache->program = program;
+	cache->output = output;
+	cache->threshold = threshold;
+	cache->hotness = calloc(program->size, sizeof(int32_t));
+	cache->traces = calloc(program->size, sizeof(kyou_jit*));
+	cache->recording = 0;
+	cache->length = 0;
+}
+
+void trace_cache_free(trace_cache* cache)
+{
+	for (size_t pc = 0; pc < cache->program->size; ++pc) {
+		if (cache->traces[pc]) {
+			jit_free(cache->traces[pc]);
+			free(cache->traces[pc]);
+		}
+	}
+	free(cache->traces);
+	free(cache->hotness);
+}
+
+const kyou_jit* trace_loop_head(trace_cache* cache, size_t target)
+{
+	// nested loops are recorded as a part of the outer one instead
+	if (cache->recording)
+		return NULL;
+
+	if (cache->traces[target])
+		return cache->traces[target];
+
+	if (cache->hotness[target] >= 0 && (uint32_t)++cache->hotness[target] >= cache->threshold) {
+		cache->recording = 1;
+		cache->anchor = target;
+		cache->length = 0;
+	}
+	return NULL;
+}
+
+static void finish_trace(trace_cache* cache, int close)
+{
+	kyou_jit* trace = malloc(sizeof(kyou_jit));
+
+	cache->recording = 0;
+
+	if (close && jit_compile_trace(cache->program, cache->output, cache->buffer, cache->length, trace) == JIT_SUCCESS) {
+		cache->traces[cache->anchor] = trace;
+	} else {
+		// never try this loop head again
+		free(trace);
+		cache->hotness[cache->anchor] = -1;
+	}
+}
+
+void trace_record(trace_cache* cache, size_t pc)
+{
+	if (cache->length > 0 && pc == cache->anchor) {
+		finish_trace(cache, 1);
+		return;
+	}
+
+	// superinstructions run all of their parts without dispatching again
+	size_t parts = opcode_fused_size(cache->program->code[pc].opcode);
+	if (cache->length + parts > TRACE_MAX_LENGTH) {
+		finish_trace(cache, 0);
+		return;
+	}
+
+	for (size_t i = 0; i < parts; ++i)
+		cache->buffer[cache->length++] = pc + i;
+}
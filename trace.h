@@ -0,0 +1,35 @@
+#pragma once
+
+#include "bytecode.h"
+#include "jit.h"
+#include "output.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRACE_MAX_LENGTH 512
+
+// per-program state of the tracing tier: how hot every loop head is,
+// the traces compiled so far and the one being recorded right now
+typedef struct {
+	const kyou_program* program;
+	kyou_output* output;
+	uint32_t threshold;
+	int32_t* hotness; // negative once a loop head failed to trace
+	kyou_jit** traces;
+
+	int recording;
+	size_t anchor;
+	uint32_t buffer[TRACE_MAX_LENGTH];
+	size_t length;
+} trace_cache;
+
+void trace_cache_init(trace_cache* cache, const kyou_program* program, kyou_output* output, uint32_t threshold);
+void trace_cache_free(trace_cache* cache);
+
+// called on every taken backward jump, returns the trace compiled for target
+// if there is one and starts recording one once target gets hot enough
+const kyou_jit* trace_loop_head(trace_cache* cache, size_t target);
+
+// called for every dispatched instruction while recording
+void trace_record(trace_cache* cache, size_t pc);
@@ -4,11 +4,9 @@
 
 #define UTF8_BOM "\xEF\xBB\xBF"
 
-int utf8_has_bom(const char* data)
+int utf8_has_bom(const char* data, size_t size)
 {
-	if (strncmp(data, UTF8_BOM, sizeof(UTF8_BOM)) == 0)
-		return 1;
-	return 0;
+	return size >= sizeof(UTF8_BOM) - 1 && memcmp(data, UTF8_BOM, sizeof(UTF8_BOM) - 1) == 0;
 }
 
 int utf8_size(char ch)
@@ -24,4 +22,22 @@ int utf8_size(char ch)
 
 	// probably should throw an error
 	return 1;
-}
\ No newline at end of file
+}
+
+uint32_t utf8_decode(const char* p, const char* end, int* size)
+{
+	const unsigned char* s = (const unsigned char*)p;
+	*size = utf8_size(*p);
+	if (*size == 1 || end - p < *size)
+		return *size == 1 && s[0] < 0x80 ? s[0] : UTF8_INVALID;
+
+	uint32_t code_point = s[0] & (0x7F >> *size);
+	for (int i = 1; i < *size; ++i) {
+		if ((s[i] & 0xC0) != 0x80) {
+			*size = i;
+			return UTF8_INVALID;
+		}
+		code_point = code_point << 6 | (s[i] & 0x3F);
+	}
+	return code_point;
+}
@@ -1,6 +1,14 @@
 ﻿#pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+
 #define IS_UTF8(a) ((a) & (1 << 7))
+// what utf8_decode gives for malformed sequences
+#define UTF8_INVALID 0xFFFD
 
-int utf8_has_bom(const char* data);
+int utf8_has_bom(const char* data, size_t size);
 int utf8_size(char ch);
+
+// decodes the code point at p, storing the number of bytes it takes in size
+uint32_t utf8_decode(const char* p, const char* end, int* size);
@@ -0,0 +1,293 @@
+#include "x64.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define EMIT(v) emit_bytes(b, &(v), sizeof(v))
+
+#define REX_W 0x48
+#define REX_R(reg) ((reg) & 0x8 ? 0x4 : 0)
+#define REX_X(reg) ((reg) & 0x8 ? 0x2 : 0)
+#define REX_B(reg) ((reg) & 0x8 ? 0x1 : 0)
+
+uint8_t kyou_reg2x64id(kyou_register_t reg)
+{
+	switch (reg) {
+		case REG_FIRE:
+			return 3; //rbx
+		case REG_WATER:
+			return 12; //r12
+		case REG_TREE:
+			return 13; //r13
+		case REG_METAL:
+			return 14; //r14
+		case REG_EARTH:
+			return 15; //r15
+		case REG_STORAGE:
+			return 4; //rsp
+		case REG_STORAGE_BASE:
+			return 5; //rbp
+	}
+	return 0;
+}
+
+void emit_bytes(x64_buffer* b, const void* bytes, size_t count)
+{
+	if (b->size + count >= b->capacity) {
+		b->data = realloc(b->data, b->capacity + 4096);
+		b->capacity += 4096;
+	}
+	memcpy(b->data + b->size, bytes, count);
+	b->size += count;
+}
+
+void x64_buffer_free(x64_buffer* b)
+{
+	free(b->data);
+	*b = (x64_buffer){ 0 };
+}
+
+int x64_fits_imm32(int64_t imm)
+{
+	return imm >= INT32_MIN && imm <= INT32_MAX;
+}
+
+// <op> reg1, reg2 for the classic two operand ALU opcodes
+static void emit_alu_r2r(x64_buffer* b, uint8_t opcode, uint8_t reg1, uint8_t reg2)
+{
+	// 0100WRXB
+	uint8_t rex = REX_W | REX_B(reg1) | REX_R(reg2);
+	uint8_t modRM = 0xC0 | ((reg2 & 0x7) << 3) | (reg1 & 0x7);
+
+	EMIT(rex);
+	EMIT(opcode);
+	EMIT(modRM);
+}
+
+// <op> reg, imm32 through the 0x81 group, ext selecting the operation
+static void emit_alu_imm2r(x64_buffer* b, uint8_t ext, uint8_t reg, uint64_t imm)
+{
+	uint32_t imm32 = (uint32_t)imm;
+	uint8_t rex = REX_W | REX_B(reg);
+	uint8_t opcode = 0x81;
+	uint8_t modRM = 0xC0 | (ext << 3) | (reg & 0x7);
+
+	EMIT(rex);
+	EMIT(opcode);
+	EMIT(modRM);
+	EMIT(imm32);
+}
+
+// [base + disp32] addressing, rsp and r12 as a base need a SIB byte
+static void emit_mem_operand(x64_buffer* b, uint8_t opcode, uint8_t reg, uint8_t base, int32_t disp)
+{
+	uint8_t rex = REX_W | REX_R(reg) | REX_B(base);
+	uint8_t modRM = 0x80 | ((reg & 0x7) << 3) | (base & 0x7);
+
+	EMIT(rex);
+	EMIT(opcode);
+	EMIT(modRM);
+	if ((base & 0x7) == X64_RSP) {
+		uint8_t sib = 0x24;
+		EMIT(sib);
+	}
+	EMIT(disp);
+}
+
+void emit_move_r2r(x64_buffer* b, uint8_t reg1, uint8_t reg2)
+{
+	emit_alu_r2r(b, 0x89, reg1, reg2);
+}
+
+void emit_move_imm2r(x64_buffer* b, uint8_t reg, uint64_t imm)
+{
+	uint8_t rex = REX_W | REX_B(reg);
+	uint8_t opcode = 0xB8 + (reg & 0x7);
+
+	EMIT(rex);
+	EMIT(opcode);
+	EMIT(imm);
+}
+
+void emit_load(x64_buffer* b, uint8_t reg, uint8_t base, int32_t disp)
+{
+	emit_mem_operand(b, 0x8B, reg, base, disp);
+}
+
+void emit_store(x64_buffer* b, uint8_t base, int32_t disp, uint8_t reg)
+{
+	emit_mem_operand(b, 0x89, reg, base, disp);
+}
+
+void emit_load_indexed(x64_buffer* b, uint8_t reg, uint8_t base, uint8_t index)
+{
+	// mov reg, [base + index*8]; rbp and r13 can only be a base with a displacement
+	int needs_disp = (base & 0x7) == X64_RBP;
+	uint8_t rex = REX_W | REX_R(reg) | REX_X(index) | REX_B(base);
+	uint8_t opcode = 0x8B;
+	uint8_t modRM = (needs_disp ? 0x44 : 0x04) | ((reg & 0x7) << 3);
+	uint8_t sib = 0xC0 | ((index & 0x7) << 3) | (base & 0x7);
+	uint8_t disp8 = 0;
+
+	EMIT(rex);
+	EMIT(opcode);
+	EMIT(modRM);
+	EMIT(sib);
+	if (needs_disp)
+		EMIT(disp8);
+}
+
+void emit_add_r2r(x64_buffer* b, uint8_t reg1, uint8_t reg2)
+{
+	emit_alu_r2r(b, 0x01, reg1, reg2);
+}
+
+void emit_add_imm2r(x64_buffer* b, uint8_t reg, uint64_t imm)
+{
+	emit_alu_imm2r(b, 0, reg, imm);
+}
+
+void emit_sub_r2r(x64_buffer* b, uint8_t reg1, uint8_t reg2)
+{
+	emit_alu_r2r(b, 0x29, reg1, reg2);
+}
+
+void emit_sub_imm2r(x64_buffer* b, uint8_t reg, uint64_t imm)
+{
+	emit_alu_imm2r(b, 5, reg, imm);
+}
+
+void emit_cmp_r2r(x64_buffer* b, uint8_t reg1, uint8_t reg2)
+{
+	emit_alu_r2r(b, 0x39, reg1, reg2);
+}
+
+void emit_cmp_imm2r(x64_buffer* b, uint8_t reg, uint64_t imm)
+{
+	emit_alu_imm2r(b, 7, reg, imm);
+}
+
+void emit_imul_r2r(x64_buffer* b, uint8_t reg1, uint8_t reg2)
+{
+	// imul reg1, reg2 has the destination in the reg field
+	uint8_t rex = REX_W | REX_R(reg1) | REX_B(reg2);
+	uint8_t opcode[] = { 0x0F, 0xAF };
+	uint8_t modRM = 0xC0 | ((reg1 & 0x7) << 3) | (reg2 & 0x7);
+
+	EMIT(rex);
+	EMIT(opcode);
+	EMIT(modRM);
+}
+
+void emit_imul_imm2r(x64_buffer* b, uint8_t reg, uint64_t imm)
+{
+	uint32_t imm32 = (uint32_t)imm;
+	uint8_t rex = REX_W | REX_R(reg) | REX_B(reg);
+	uint8_t opcode = 0x69;
+	uint8_t modRM = 0xC0 | ((reg & 0x7) << 3) | (reg & 0x7);
+
+	EMIT(rex);
+	EMIT(opcode);
+	EMIT(modRM);
+	EMIT(imm32);
+}
+
+void emit_cqo(x64_buffer* b)
+{
+	uint8_t opcode[] = { REX_W, 0x99 };
+	EMIT(opcode);
+}
+
+void emit_idiv_r(x64_buffer* b, uint8_t reg)
+{
+	uint8_t rex = REX_W | REX_B(reg);
+	uint8_t opcode = 0xF7;
+	uint8_t modRM = 0xF8 | (reg & 0x7);
+
+	EMIT(rex);
+	EMIT(opcode);
+	EMIT(modRM);
+}
+
+// push/pop/call/jmp have no REX.W, just REX.B for the upper registers
+static void emit_short_r(x64_buffer* b, uint8_t opcode, uint8_t reg)
+{
+	if (reg & 0x8) {
+		uint8_t rex = 0x41;
+		EMIT(rex);
+	}
+	opcode += reg & 0x7;
+	EMIT(opcode);
+}
+
+void emit_push_r(x64_buffer* b, uint8_t reg)
+{
+	emit_short_r(b, 0x50, reg);
+}
+
+void emit_pop_r(x64_buffer* b, uint8_t reg)
+{
+	emit_short_r(b, 0x58, reg);
+}
+
+// call/jmp through a register, ext selecting which one in the 0xFF group
+static void emit_indirect_r(x64_buffer* b, uint8_t ext, uint8_t reg)
+{
+	if (reg & 0x8) {
+		uint8_t rex = 0x41;
+		EMIT(rex);
+	}
+	uint8_t opcode = 0xFF;
+	uint8_t modRM = 0xC0 | (ext << 3) | (reg & 0x7);
+
+	EMIT(opcode);
+	EMIT(modRM);
+}
+
+void emit_call_r(x64_buffer* b, uint8_t reg)
+{
+	emit_indirect_r(b, 2, reg);
+}
+
+void emit_jmp_r(x64_buffer* b, uint8_t reg)
+{
+	emit_indirect_r(b, 4, reg);
+}
+
+void emit_ret(x64_buffer* b)
+{
+	uint8_t opcode = 0xC3;
+	EMIT(opcode);
+}
+
+void emit_syscall(x64_buffer* b)
+{
+	uint16_t opcode = 0x050f;
+	EMIT(opcode);
+}
+
+size_t emit_jmp_rel32(x64_buffer* b)
+{
+	uint8_t opcode = 0xE9;
+	uint32_t rel32 = 0;
+
+	EMIT(opcode);
+	EMIT(rel32);
+	return b->size - sizeof(rel32);
+}
+
+size_t emit_jcc_rel32(x64_buffer* b, uint8_t cc)
+{
+	uint8_t opcode[] = { 0x0F, 0x80 | cc };
+	uint32_t rel32 = 0;
+
+	EMIT(opcode);
+	EMIT(rel32);
+	return b->size - sizeof(rel32);
+}
+
+void x64_patch_rel32(x64_buffer* b, size_t at, size_t target)
+{
+	int32_t rel32 = (int32_t)(target - (at + sizeof(rel32)));
+	memcpy(b->data + at, &rel32, sizeof(rel32));
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "ast.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// growable buffer of machine code, shared by kyouc and the JIT
+typedef struct {
+	unsigned char* data;
+	size_t size;
+	size_t capacity;
+} x64_buffer;
+
+enum {
+	X64_RAX, X64_RCX, X64_RDX, X64_RBX, X64_RSP, X64_RBP, X64_RSI, X64_RDI,
+	X64_R8, X64_R9, X64_R10, X64_R11, X64_R12, X64_R13, X64_R14, X64_R15
+};
+
+// condition codes for emit_jcc_rel32
+enum {
+	X64_CC_B = 0x2, X64_CC_AE = 0x3, X64_CC_E = 0x4, X64_CC_NE = 0x5,
+	X64_CC_L = 0xC, X64_CC_GE = 0xD, X64_CC_LE = 0xE, X64_CC_G = 0xF
+};
+
+uint8_t kyou_reg2x64id(kyou_register_t reg);
+
+void emit_bytes(x64_buffer* b, const void* bytes, size_t count);
+void x64_buffer_free(x64_buffer* b);
+
+void emit_move_r2r(x64_buffer* b, uint8_t reg1, uint8_t reg2);
+void emit_move_imm2r(x64_buffer* b, uint8_t reg, uint64_t imm);
+void emit_load(x64_buffer* b, uint8_t reg, uint8_t base, int32_t disp);
+void emit_store(x64_buffer* b, uint8_t base, int32_t disp, uint8_t reg);
+void emit_load_indexed(x64_buffer* b, uint8_t reg, uint8_t base, uint8_t index);
+
+void emit_add_r2r(x64_buffer* b, uint8_t reg1, uint8_t reg2);
+void emit_add_imm2r(x64_buffer* b, uint8_t reg, uint64_t imm);
+void emit_sub_r2r(x64_buffer* b, uint8_t reg1, uint8_t reg2);
+void emit_sub_imm2r(x64_buffer* b, uint8_t reg, uint64_t imm);
+void emit_imul_r2r(x64_buffer* b, uint8_t reg1, uint8_t reg2);
+void emit_imul_imm2r(x64_buffer* b, uint8_t reg, uint64_t imm);
+void emit_cmp_r2r(x64_buffer* b, uint8_t reg1, uint8_t reg2);
+void emit_cmp_imm2r(x64_buffer* b, uint8_t reg, uint64_t imm);
+void emit_cqo(x64_buffer* b);
+void emit_idiv_r(x64_buffer* b, uint8_t reg);
+
+void emit_push_r(x64_buffer* b, uint8_t reg);
+void emit_pop_r(x64_buffer* b, uint8_t reg);
+void emit_call_r(x64_buffer* b, uint8_t reg);
+void emit_jmp_r(x64_buffer* b, uint8_t reg);
+void emit_ret(x64_buffer* b);
+void emit_syscall(x64_buffer* b);
+
+// relative jumps return the offset of their rel32 field for x64_patch_rel32
+size_t emit_jmp_rel32(x64_buffer* b);
+size_t emit_jcc_rel32(x64_buffer* b, uint8_t cc);
+void x64_patch_rel32(x64_buffer* b, size_t at, size_t target);
+
+// whether imm survives the sign extension of 32-bit immediate forms
+int x64_fits_imm32(int64_t imm);